@@ -0,0 +1,437 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* QuadTree over integer (or fixed-point) coordinates with power of 2 bounds.
+*
+* The root covers [x, x + 2^bits) on both axes, so the quadrant boundaries at every depth are powers of 2 and
+* the quadrant a point belongs to at depth d is bit (bits - 1 - d) of its x and y offsets: descending the tree is a shift and a mask
+* per level, no midpoint is computed, and the path from the root to a point is its Morton key (see mortonKey()).
+* Coordinates are compared exactly, so grid-snapped data has none of the float equality problems of QuadTree.
+* For fixed-point data, scale the values to integers (e.g. x * 256 for 8 fractional bits) and use the integer tree.
+*
+* A quadrant at max depth is a single cell, so every leaf holds at most one node there and the tree can't subdivide forever.
+* Nodes outside the bounds are rejected instead of being pushed to the edges like QuadTree does.
+*/
+
+#pragma once
+#include <vector>
+#include <queue>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+#include "QNode.h"
+#include "LinearQuadtree.hpp" //mortonEncode
+
+template<class T, class Coord = uint32_t>
+class GridQuadTree
+{
+	static_assert(std::is_integral<Coord>::value && sizeof(Coord) <= 4, "GridQuadTree needs an integer coordinate type of 32 bits or less");
+
+public:
+	typedef QNode<T, Coord> Node;
+
+	GridQuadTree(const GridQuadTree&) = delete;				//forbid copy constructor
+	GridQuadTree& operator=(GridQuadTree const&) = delete;	//forbid copy assignment operator
+	GridQuadTree() = delete;								//forbid default constructor
+
+	//x,y is the top left corner, the tree covers [x, x + 2^@bits) on both axes. @bits is clamped to the bits of Coord.
+	//bucket capacity is the amount of node can be represent by each quadrant before it splits.
+	//@depth specifies how many times a tree can split, capped at @bits (quadrants of a single cell).
+	explicit GridQuadTree(Coord x, Coord y, int bits, int bucketCapacity, int depth = INT32_MAX)
+	{
+		m_x = x;
+		m_y = y;
+		m_bits = std::max(0, std::min(bits, int(sizeof(Coord) * 8)));
+		m_bucketCapacity = std::max(1, bucketCapacity);
+		m_maxDepth = std::max(0, std::min(depth, m_bits));
+		m_quads.push_back(makeQuadrant(-1, 0, 0, 0));
+		m_freeQuads = -1;
+	}
+
+	/* Inserts a node at x,y holding @data, the leaf is split once it holds more than bucket capacity nodes.
+	* returns false if x,y is outside of the tree or a node with the same coordinates is already in it.
+	* O(log4(N)) shifts and masks to find the leaf.
+	*/
+	bool insert(Coord x, Coord y, const T& data)
+	{
+		if (!contains(x, y)) {
+			return false;
+		}
+		int leaf = leafOf(offsetX(x), offsetY(y));
+		vector<Node>& bucket = m_quads[leaf].nodes;
+		if (indexInBucket(bucket, x, y) >= 0) {
+			return false;
+		}
+		bucket.push_back(Node(x, y, data));
+		for (int q = leaf; q >= 0; q = m_quads[q].parent) {
+			m_quads[q].count++;
+		}
+		if (int(bucket.size()) > m_bucketCapacity && m_quads[leaf].depth < m_maxDepth) {
+			subdivide(leaf);
+		}
+		return true;
+	}
+
+	/* same as above, takes the coordinates and the data from @node */
+	bool insert(const Node& node)
+	{
+		return insert(node.x, node.y, node.m_data);
+	}
+
+	/* true if a node sits at x,y */
+	bool find(Coord x, Coord y) const
+	{
+		if (!contains(x, y)) {
+			return false;
+		}
+		int leaf = leafOf(offsetX(x), offsetY(y));
+		return indexInBucket(m_quads[leaf].nodes, x, y) >= 0;
+	}
+
+	bool find(const Node& node) const
+	{
+		return find(node.x, node.y);
+	}
+
+	/* Removes the node at x,y, then merges the highest ancestor whose subtrees hold bucket capacity nodes or less.
+	* returns false if there is no node at x,y.
+	*/
+	bool remove(Coord x, Coord y)
+	{
+		if (!contains(x, y)) {
+			return false;
+		}
+		int leaf = leafOf(offsetX(x), offsetY(y));
+		vector<Node>& bucket = m_quads[leaf].nodes;
+		int index = indexInBucket(bucket, x, y);
+		if (index < 0) {
+			return false;
+		}
+		bucket[index] = std::move(bucket.back());
+		bucket.pop_back();
+		int top = -1;
+		for (int q = leaf; q >= 0; q = m_quads[q].parent) {
+			m_quads[q].count--;
+			if (q != leaf && m_quads[q].count <= m_bucketCapacity) {
+				top = q;
+			}
+		}
+		if (top >= 0) {
+			merge(top);
+		}
+		return true;
+	}
+
+	bool remove(const Node& node)
+	{
+		return remove(node.x, node.y);
+	}
+
+	/* Moves @node to x,y, @node is updated too. Nothing happens if @node isn't in the tree, x,y is outside of it or taken. */
+	void update(Node& node, Coord x, Coord y)
+	{
+		if (!contains(x, y) || find(x, y) || !find(node)) {
+			return;
+		}
+		int leaf = leafOf(offsetX(node.x), offsetY(node.y));
+		const vector<Node>& bucket = m_quads[leaf].nodes;
+		T data = bucket[indexInBucket(bucket, node.x, node.y)].m_data;
+		remove(node.x, node.y);
+		insert(x, y, data);
+		node.x = x;
+		node.y = y;
+	}
+
+	/* Calls @visitor(const Node&) for every node inside the rectangle x1,y1 - x2,y2 (inclusive).
+	* Quadrant bounds are integers too, so pruning is exact.
+	*/
+	template<class Visitor>
+	void query(Coord x1, Coord y1, Coord x2, Coord y2, Visitor&& visitor) const
+	{
+		int64_t qx1 = std::max<int64_t>(int64_t(x1) - m_x, 0), qy1 = std::max<int64_t>(int64_t(y1) - m_y, 0);
+		int64_t qx2 = std::min<int64_t>(int64_t(x2) - m_x, extent() - 1), qy2 = std::min<int64_t>(int64_t(y2) - m_y, extent() - 1);
+		if (qx1 > qx2 || qy1 > qy2) {
+			return;
+		}
+		queryHelper(0, qx1, qy1, qx2, qy2, visitor);
+	}
+
+	/* same as above, but appends the nodes found to @out instead. */
+	void query(Coord x1, Coord y1, Coord x2, Coord y2, vector<const Node*>& out) const
+	{
+		query(x1, y1, x2, y2, [&out](const Node& node) { out.push_back(&node); });
+	}
+
+	/* Appends the @k closest nodes to x,y onto @out, sorted from closest to farthest. best-first, same as QuadTree::nearest(). */
+	void nearest(Coord x, Coord y, size_t k, vector<const Node*>& out) const
+	{
+		if (k == 0) {
+			return;
+		}
+		typedef std::pair<double, int> QuadrantDist;
+		typedef std::pair<double, const Node*> NodeDist;
+		std::priority_queue<QuadrantDist, vector<QuadrantDist>, std::greater<QuadrantDist>> pending;
+		std::priority_queue<NodeDist> best;
+		double px = double(int64_t(x) - m_x), py = double(int64_t(y) - m_y);
+
+		pending.emplace(minDistSq(m_quads[0], px, py), 0);
+		while (!pending.empty()) {
+			QuadrantDist top = pending.top();
+			pending.pop();
+			if (best.size() == k && top.first > best.top().first) {
+				break;
+			}
+			const Quadrant& quad = m_quads[top.second];
+			if (quad.firstChild >= 0) {
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					int child = quad.firstChild + quadrant;
+					double distSq = minDistSq(m_quads[child], px, py);
+					if (best.size() < k || distSq < best.top().first) {
+						pending.emplace(distSq, child);
+					}
+				}
+				continue;
+			}
+			for (const Node& node : quad.nodes) {
+				double dx = double(int64_t(node.x) - int64_t(x)), dy = double(int64_t(node.y) - int64_t(y));
+				double distSq = dx * dx + dy * dy;
+				if (best.size() < k) {
+					best.emplace(distSq, &node);
+				}
+				else if (distSq < best.top().first) {
+					best.pop();
+					best.emplace(distSq, &node);
+				}
+			}
+		}
+		size_t start = out.size();
+		out.resize(start + best.size());
+		for (size_t i = out.size(); i > start; --i) {
+			out[i - 1] = best.top().second;
+			best.pop();
+		}
+	}
+
+	/* Calls @fn(const Node&) for every node. leaves are visited NW, NE, SW, SE depth first, in increasing mortonKey() order
+	* (nodes of the same leaf aren't sorted).
+	*/
+	template<class Fn>
+	void forEach(Fn&& fn) const
+	{
+		forEachHelper(0, fn);
+	}
+
+	/* Morton (Z-order) key of x,y: the quadrant bits of every level from the root down, 2 bits per level, x on the even bits.
+	* Comparing keys orders points the way forEach() visits leaves. x,y must be inside the tree.
+	*/
+	inline uint64_t mortonKey(Coord x, Coord y) const
+	{
+		return mortonEncode(offsetX(x), offsetY(y));
+	}
+
+	/* removes all the elements, keeps the allocated storage around for reuse. */
+	void clear()
+	{
+		m_quads.resize(1);
+		m_quads[0] = makeQuadrant(-1, 0, 0, 0);
+		m_freeQuads = -1;
+	}
+
+	/* true if x,y is inside the bounds of the tree */
+	inline bool contains(Coord x, Coord y) const
+	{
+		int64_t dx = int64_t(x) - m_x, dy = int64_t(y) - m_y;
+		return dx >= 0 && dy >= 0 && dx < extent() && dy < extent();
+	}
+
+	/* Getters */
+	inline Coord getX() const { return m_x; }
+	inline Coord getY() const { return m_y; }
+	inline int getBits() const { return m_bits; }
+	inline int getBucketCapacity() const { return m_bucketCapacity; }
+	inline int getMaxDepth() const { return m_maxDepth; }
+	inline int size() const { return m_quads[0].count; }
+
+	/* bytes reserved by the pools, divide by size() to get the memory cost per node. */
+	size_t bytesUsed() const
+	{
+		size_t bytes = sizeof(*this) + m_quads.capacity() * sizeof(Quadrant);
+		for (const Quadrant& quad : m_quads) {
+			bytes += quad.nodes.capacity() * sizeof(Node);
+		}
+		return bytes;
+	}
+
+private:
+
+	/* A quadrant of the tree. ox,oy is its top left corner as an offset from the tree's x,y, its side is 2^(bits - depth).
+	* subtrees are 4 consecutive records (NW, NE, SW, SE) starting at firstChild.
+	* the bucket lives in the record, one less indirection than a separate pool on the way from the leaf to its nodes.
+	*/
+	struct Quadrant
+	{
+		uint32_t ox, oy;
+		int parent;			//-1 for the root. non-owning.
+		int firstChild;		//-1 if the quadrant is a leaf.
+		int count;			//num of nodes in this quadrant and all of its subtrees.
+		int depth;
+		vector<Node> nodes;	//bucket, empty for quadrants that aren't leaves.
+	};
+
+	static inline Quadrant makeQuadrant(int parent, uint32_t ox, uint32_t oy, int depth)
+	{
+		Quadrant quad = { ox, oy, parent, -1, 0, depth, vector<Node>() };
+		return quad;
+	}
+
+	inline int64_t extent() const { return int64_t(1) << m_bits; }
+	inline int64_t side(const Quadrant& quad) const { return int64_t(1) << (m_bits - quad.depth); }
+	inline uint32_t offsetX(Coord x) const { return uint32_t(int64_t(x) - m_x); }
+	inline uint32_t offsetY(Coord y) const { return uint32_t(int64_t(y) - m_y); }
+
+	/* quadrant of ox,oy below a quadrant at @depth: bit (bits - 1 - depth) of each offset, same encoding as QuadTree::checkQuadrant. */
+	inline int quadrantOf(uint32_t ox, uint32_t oy, int depth) const
+	{
+		int shift = m_bits - 1 - depth;
+		return int((ox >> shift) & 1u) | int(((oy >> shift) & 1u) << 1);
+	}
+
+	int leafOf(uint32_t ox, uint32_t oy) const
+	{
+		int q = 0;
+		while (m_quads[q].firstChild >= 0) {
+			q = m_quads[q].firstChild + quadrantOf(ox, oy, m_quads[q].depth);
+		}
+		return q;
+	}
+
+	static int indexInBucket(const vector<Node>& bucket, Coord x, Coord y)
+	{
+		for (size_t i = 0; i < bucket.size(); ++i) {
+			if (bucket[i].x == x && bucket[i].y == y) {
+				return int(i);
+			}
+		}
+		return -1;
+	}
+
+	/* returns the index of 4 consecutive unused quadrants, recycled from the free list if possible. */
+	int allocQuadrants()
+	{
+		if (m_freeQuads >= 0) {
+			int index = m_freeQuads;
+			m_freeQuads = m_quads[index].firstChild;
+			return index;
+		}
+		m_quads.resize(m_quads.size() + 4);
+		return int(m_quads.size() - 4);
+	}
+
+	/* splits leaf @q in 4 and pushes its nodes down, subtrees still over capacity are split again. */
+	void subdivide(int q)
+	{
+		int first = allocQuadrants();	//can move the records, references are taken after it.
+		Quadrant& quad = m_quads[q];
+		uint32_t half = uint32_t(side(quad) >> 1);
+		int depth = quad.depth + 1;
+		m_quads[first] = makeQuadrant(q, quad.ox, quad.oy, depth);
+		m_quads[first + 1] = makeQuadrant(q, quad.ox + half, quad.oy, depth);
+		m_quads[first + 2] = makeQuadrant(q, quad.ox, quad.oy + half, depth);
+		m_quads[first + 3] = makeQuadrant(q, quad.ox + half, quad.oy + half, depth);
+		quad.firstChild = first;
+
+		for (Node& node : quad.nodes) {
+			int child = first + quadrantOf(offsetX(node.x), offsetY(node.y), depth - 1);
+			m_quads[child].nodes.push_back(std::move(node));
+			m_quads[child].count++;
+		}
+		vector<Node>().swap(quad.nodes);
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			int child = first + quadrant;
+			if (m_quads[child].count > m_bucketCapacity && m_quads[child].depth < m_maxDepth) {
+				subdivide(child);
+			}
+		}
+	}
+
+	/* moves every node below @top into its bucket and gives its subtrees back to the pool, @top becomes a leaf. */
+	void merge(int top)
+	{
+		int first = m_quads[top].firstChild;
+		m_quads[top].firstChild = -1;
+		collectHelper(first, m_quads[top].nodes);
+	}
+
+	void collectHelper(int first, vector<Node>& bucket)
+	{
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			int q = first + quadrant;
+			if (m_quads[q].firstChild >= 0) {
+				collectHelper(m_quads[q].firstChild, bucket);
+			}
+			else {
+				for (Node& node : m_quads[q].nodes) {
+					bucket.push_back(std::move(node));
+				}
+				vector<Node>().swap(m_quads[q].nodes);
+			}
+		}
+		m_quads[first].firstChild = m_freeQuads;
+		m_freeQuads = first;
+	}
+
+	template<class Visitor>
+	void queryHelper(int q, int64_t x1, int64_t y1, int64_t x2, int64_t y2, Visitor& visitor) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				const Quadrant& child = m_quads[quad.firstChild + quadrant];
+				int64_t last = side(child) - 1;
+				if (x1 <= int64_t(child.ox) + last && int64_t(child.ox) <= x2 && y1 <= int64_t(child.oy) + last && int64_t(child.oy) <= y2) {
+					queryHelper(quad.firstChild + quadrant, x1, y1, x2, y2, visitor);
+				}
+			}
+			return;
+		}
+		for (const Node& node : quad.nodes) {
+			int64_t ox = int64_t(node.x) - m_x, oy = int64_t(node.y) - m_y;
+			if (ox >= x1 && ox <= x2 && oy >= y1 && oy <= y2) {
+				visitor(node);
+			}
+		}
+	}
+
+	template<class Fn>
+	void forEachHelper(int q, Fn& fn) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				forEachHelper(quad.firstChild + quadrant, fn);
+			}
+			return;
+		}
+		for (const Node& node : quad.nodes) {
+			fn(node);
+		}
+	}
+
+	/* squared distance between offset px,py and the closest cell of @quad */
+	inline double minDistSq(const Quadrant& quad, double px, double py) const
+	{
+		double x1 = double(quad.ox), y1 = double(quad.oy);
+		double x2 = x1 + double(side(quad) - 1), y2 = y1 + double(side(quad) - 1);
+		double dx = (px < x1) ? x1 - px : (px > x2 ? px - x2 : 0.0);
+		double dy = (py < y1) ? y1 - py : (py > y2 ? py - y2 : 0.0);
+		return dx * dx + dy * dy;
+	}
+
+	Coord m_x, m_y;
+	int m_bits;
+	int m_bucketCapacity;
+	int m_maxDepth;
+
+	vector<Quadrant> m_quads;		//m_quads[0] is the root.
+	int m_freeQuads;				//first record of the first free group of 4 quadrants, -1 if none.
+};
@@ -0,0 +1,660 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Pointer-free (linear) QuadTree backend, exposes the same insert/find/remove/update/query API as QuadTree.
+*
+* Points are kept sorted by their Morton (Z-order) key in contiguous arrays, every node of the tree is a
+* range of that array stored as an index-linked record in a single vector, children of a node are always 4 consecutive records.
+* Because the key interleaves the quadrant bits of every level (NW, NE, SW, SE), the points of any subtree are contiguous.
+*
+* Insertions are buffered and merged into the sorted arrays the next time the tree is read, removals only mark the point dead,
+* so batch your inserts before querying. A move that keeps the key of the point rewrites it in place, any other move goes to a small
+* sorted array of moved points that reads search too, merged into the rest once it holds more than 1/256 of the tree.
+* Use QuadtreeBackend.hpp to pick between this and QuadTree at compile time.
+*/
+
+#pragma once
+#include <memory>
+#include <vector>
+#include <queue>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include "QNode.h"
+
+/* spreads the lower 32 bits of @v so there is a zero bit between each of them. */
+inline uint64_t mortonSpread(uint32_t v)
+{
+	uint64_t x = v;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | (x << 2)) & 0x3333333333333333ull;
+	x = (x | (x << 1)) & 0x5555555555555555ull;
+	return x;
+}
+
+/* interleaves x and y (x on even bits, y on odd bits), same bit layout checkQuadrant uses for quadrants. */
+inline uint64_t mortonEncode(uint32_t x, uint32_t y)
+{
+	return mortonSpread(x) | (mortonSpread(y) << 1);
+}
+
+template<class T>
+class LinearQuadTree
+{
+public:
+	LinearQuadTree(const LinearQuadTree&) = delete;				//forbid copy constructor
+	LinearQuadTree& operator=(LinearQuadTree const&) = delete;	//forbid copy assignment operator
+	LinearQuadTree() = delete;									//forbid default constructor
+
+	//x1,y1 x2,y2. initially 0,0 to screen width, screen height.
+	//bucket capacity is the amount of node can be represent by each quadrant before it splits.
+	//@depth specifies how many times a tree can split, capped at MAX_KEY_DEPTH since that's the resolution of the keys.
+	explicit LinearQuadTree(float x1, float y1, float x2, float y2, int bucketCapacity, int depth = INT32_MAX)
+	{
+		m_x = x1;
+		m_y = y1;
+		m_width = x2;
+		m_height = y2;
+		m_bucketCapacity = bucketCapacity;
+		m_maxDepth = std::max(0, std::min(depth, MAX_KEY_DEPTH));
+		m_cells = uint64_t(1) << m_maxDepth;
+		m_cellWidth = (double(x2) - double(x1)) / double(m_cells);
+		m_cellHeight = (double(y2) - double(y1)) / double(m_cells);
+		m_deadCount = 0;
+		m_dirty = true;
+	}
+
+	/* copies @node into the insertion buffer, it becomes visible to queries on the next read. */
+	void insert(QNode<T> *node)
+	{
+		/* Can't insert nullptr */
+		if (node == nullptr) {
+			return;
+		}
+		m_pending.emplace_back(node);
+		m_dirty = true;
+	}
+
+	/* instead of passing QNode, you can pass necessary info to create a QNode
+	* @param x:		x-coordiante of the node
+	* @param y:		y-coordinate of the node
+	* @param data:		data the node holds
+	*/
+	void insert(float x, float y, const T& data)
+	{
+		m_pending.emplace_back(x, y, data);
+		m_dirty = true;
+	}
+
+	/* Builds the tree from @count nodes starting at @nodes, keys are computed and sorted once instead of per insertion.
+	* @threads is accepted for API compatibility with QuadTree::bulkLoad, sorting happens on the calling thread.
+	* O(N log(N))
+	*/
+	void bulkLoad(const QNode<T>* nodes, size_t count, unsigned threads = 0)
+	{
+		(void)threads;
+		if (nodes == nullptr || count == 0) {
+			return;
+		}
+		m_pending.insert(m_pending.end(), nodes, nodes + count);
+		m_dirty = true;
+		flush();
+	}
+
+	/* same as above, takes every node in @nodes */
+	void bulkLoad(const vector<QNode<T>>& nodes, unsigned threads = 0)
+	{
+		bulkLoad(nodes.data(), nodes.size(), threads);
+	}
+
+	/* Given @node, moves it to given x,y coordinates.
+	* If the key doesn't change the point is updated in place, otherwise the old entry is marked dead
+	* and the moved one is inserted in the sorted array of moved points: O(log(N) + M), M = num of moved points.
+	* Nothing happens if @node isn't in the tree or another node already sits at x,y.
+	*/
+	void update(QNode<T>& node, float x, float y)
+	{
+		int64_t index = findIndex(node);
+		int64_t moved = index < 0 ? findMoved(node) : -1;
+		if ((index < 0 && moved < 0) || (node.x == x && node.y == y) || find(QNode<T>(x, y))) {
+			return;
+		}
+		uint64_t key = keyOf(x, y);
+		if (index >= 0 && m_keys[size_t(index)] == key) {
+			m_points[size_t(index)].x = x;
+			m_points[size_t(index)].y = y;
+			reorder(size_t(index));
+		}
+		else {
+			QNode<T> point = (index >= 0) ? m_points[size_t(index)] : m_moved[size_t(moved)];
+			point.x = x;
+			point.y = y;
+			if (index >= 0) {
+				markDead(size_t(index));
+			}
+			else {
+				eraseMoved(size_t(moved));
+			}
+			insertMoved(key, point);
+		}
+		node.x = x;
+		node.y = y;
+	}
+
+	/* removes all the elements, keeps the allocated storage around for reuse. */
+	void clear()
+	{
+		m_keys.clear();
+		m_points.clear();
+		m_dead.clear();
+		m_pending.clear();
+		m_movedKeys.clear();
+		m_moved.clear();
+		m_tree.clear();
+		m_deadCount = 0;
+		m_dirty = true;
+	}
+
+	/* Given node returns all the nodes in the same quadrant as @node, appended to @out. */
+	void getPossibleCollisions(const QNode<T>& node, vector<const QNode<T>*>& out) const
+	{
+		flush();
+		uint64_t key = keyOf(node.x, node.y);
+		const LinearNode* leaf = &m_tree[0];
+		while (leaf->firstChild >= 0) {
+			int shift = 2 * (m_maxDepth - leaf->depth - 1);
+			leaf = &m_tree[leaf->firstChild + int((key >> shift) & 3)];
+		}
+		for (uint32_t i = leaf->begin; i < leaf->end; ++i) {
+			if (!m_dead[i]) {
+				out.push_back(&m_points[i]);
+			}
+		}
+		uint64_t first = mortonEncode(leaf->cx, leaf->cy);
+		visitMoved(first, first + ((uint64_t(1) << (2 * (m_maxDepth - leaf->depth))) - 1), [&out](const QNode<T>& n) { out.push_back(&n); });
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node inside the rectangle x1,y1 - x2,y2 (inclusive).
+	* subtrees are pruned in key space, so pruning agrees exactly with how points were bucketed.
+	*/
+	template<class Visitor>
+	void query(float x1, float y1, float x2, float y2, Visitor&& visitor) const
+	{
+		flush();
+		QueryRect rect = { x1, y1, x2, y2, quantize(x1, m_x, m_cellWidth), quantize(y1, m_y, m_cellHeight),
+			quantize(x2, m_x, m_cellWidth), quantize(y2, m_y, m_cellHeight) };
+		queryHelper(0, rect, visitor);
+		//keys of the points inside the rectangle lie between the keys of its corners.
+		visitMoved(mortonEncode(rect.cx1, rect.cy1), mortonEncode(rect.cx2, rect.cy2), [&](const QNode<T>& n) {
+			if (x1 <= n.x && n.x <= x2 && y1 <= n.y && n.y <= y2) {
+				visitor(n);
+			}
+		});
+	}
+
+	/* same as above, but appends the nodes found to @out instead. */
+	void query(float x1, float y1, float x2, float y2, vector<const QNode<T>*>& out) const
+	{
+		query(x1, y1, x2, y2, [&out](const QNode<T>& node) { out.push_back(&node); });
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node within @radius of cx,cy (inclusive). */
+	template<class Visitor>
+	void queryCircle(float cx, float cy, float radius, Visitor&& visitor) const
+	{
+		flush();
+		float radiusSq = radius * radius;
+		queryCircleHelper(0, cx, cy, radiusSq, visitor);
+		uint64_t first = mortonEncode(quantize(cx - radius, m_x, m_cellWidth), quantize(cy - radius, m_y, m_cellHeight));
+		uint64_t last = mortonEncode(quantize(cx + radius, m_x, m_cellWidth), quantize(cy + radius, m_y, m_cellHeight));
+		visitMoved(first, last, [&](const QNode<T>& n) {
+			float dx = n.x - cx;
+			float dy = n.y - cy;
+			if (dx * dx + dy * dy <= radiusSq) {
+				visitor(n);
+			}
+		});
+	}
+
+	/* same as above, but appends the nodes found to @out instead. */
+	void queryCircle(float cx, float cy, float radius, vector<const QNode<T>*>& out) const
+	{
+		queryCircle(cx, cy, radius, [&out](const QNode<T>& node) { out.push_back(&node); });
+	}
+
+	/* Appends the @k closest nodes to x,y onto @out, sorted from closest to farthest. */
+	void nearest(float x, float y, size_t k, vector<const QNode<T>*>& out) const
+	{
+		nearestHelper(x, y, k, std::numeric_limits<float>::infinity(), out);
+	}
+
+	/* returns the closest node to x,y that's within @radius (inclusive), nullptr if there is none. */
+	const QNode<T>* nearestWithin(float x, float y, float radius) const
+	{
+		vector<const QNode<T>*> out;
+		out.reserve(1);
+		nearestHelper(x, y, 1, radius * radius, out);
+		return out.empty() ? nullptr : out.front();
+	}
+
+	/* same as above but appends up to @k closest nodes within @radius onto @out, sorted from closest to farthest. */
+	void nearestWithin(float x, float y, float radius, size_t k, vector<const QNode<T>*>& out) const
+	{
+		nearestHelper(x, y, k, radius * radius, out);
+	}
+
+	/* given node find if it's in the quadtree, O(log(N)) binary search over the keys (and the keys of the moved points). */
+	bool find(const QNode<T>& node) const
+	{
+		return findIndex(node) >= 0 || findMoved(node) >= 0;
+	}
+
+	/* marks the node dead, O(log(N)). Dead nodes are dropped the next time the arrays are rebuilt. */
+	void remove(const QNode<T>& node)
+	{
+		int64_t index = findIndex(node);
+		if (index >= 0) {
+			markDead(size_t(index));
+			return;
+		}
+		int64_t moved = findMoved(node);
+		if (moved >= 0) {
+			eraseMoved(size_t(moved));
+		}
+	}
+
+	/* Getters */
+	inline float getX() const { return m_x; }
+	inline float getY() const { return m_y; }
+	inline float getWidth() const { return m_width; }
+	inline float getHeight() const { return m_height; }
+	inline int getDepth() const { return 0; }
+	inline int size() const { flush(); return int(m_keys.size() - m_deadCount + m_moved.size()); }
+
+	/* bytes reserved by the arrays, divide by size() to get the memory cost per node. */
+	size_t bytesUsed() const
+	{
+		return sizeof(*this) + (m_keys.capacity() + m_movedKeys.capacity()) * sizeof(uint64_t)
+			+ (m_points.capacity() + m_pending.capacity() + m_moved.capacity()) * sizeof(QNode<T>)
+			+ m_dead.capacity() * sizeof(uint8_t) + m_tree.capacity() * sizeof(LinearNode);
+	}
+
+	static const int MAX_KEY_DEPTH = 31; //2 * 31 bits fit in the 64 bit key
+
+private:
+
+	/* index-linked node record, covers m_points[begin, end). cx,cy is the first cell of the node at max depth. */
+	struct LinearNode
+	{
+		uint32_t cx, cy;
+		uint32_t begin, end;
+		int32_t firstChild;	//index of the NW child in m_tree, the other 3 follow it. -1 for leaves.
+		int32_t depth;
+	};
+
+	/* query rectangle in both coordinate and cell space */
+	struct QueryRect
+	{
+		float x1, y1, x2, y2;
+		uint32_t cx1, cy1, cx2, cy2;
+	};
+
+	/* maps a coordinate to its cell at max depth, clamped to the tree. monotonic, so x1 <= x <= x2 implies cell(x1) <= cell(x) <= cell(x2). */
+	inline uint32_t quantize(float v, float origin, double cellSize) const
+	{
+		double cell = (double(v) - double(origin)) / cellSize;
+		if (!(cell > 0.0)) { //also catches NaN and zero sized trees
+			return 0;
+		}
+		if (cell >= double(m_cells)) {
+			return uint32_t(m_cells - 1);
+		}
+		return uint32_t(cell);
+	}
+
+	inline uint64_t keyOf(float x, float y) const
+	{
+		return mortonEncode(quantize(x, m_x, m_cellWidth), quantize(y, m_y, m_cellHeight));
+	}
+
+	/* points are sorted by key, then x, then y so duplicates end up next to each other. */
+	static inline bool lessThan(uint64_t lKey, const QNode<T>& lhs, uint64_t rKey, const QNode<T>& rhs)
+	{
+		if (lKey != rKey) {
+			return lKey < rKey;
+		}
+		return lhs.x < rhs.x || (lhs.x == rhs.x && lhs.y < rhs.y);
+	}
+
+	/* returns the index of the live point with the same coordinates as @node, -1 if there is none. */
+	int64_t findIndex(const QNode<T>& node) const
+	{
+		flush();
+		uint64_t key = keyOf(node.x, node.y);
+		auto range = std::equal_range(m_keys.begin(), m_keys.end(), key);
+		for (auto it = range.first; it != range.second; ++it) {
+			size_t i = size_t(it - m_keys.begin());
+			if (!m_dead[i] && m_points[i].x == node.x && m_points[i].y == node.y) {
+				return int64_t(i);
+			}
+		}
+		return -1;
+	}
+
+	inline void markDead(size_t index)
+	{
+		m_dead[index] = 1;
+		m_deadCount++;
+	}
+
+	/* moves the point at @index to its place among the points with the same key, after its coordinates changed. */
+	void reorder(size_t index)
+	{
+		while (index > 0 && m_keys[index - 1] == m_keys[index] && lessThan(m_keys[index], m_points[index], m_keys[index - 1], m_points[index - 1])) {
+			std::swap(m_points[index], m_points[index - 1]);
+			std::swap(m_dead[index], m_dead[index - 1]);
+			index--;
+		}
+		while (index + 1 < m_keys.size() && m_keys[index + 1] == m_keys[index] && lessThan(m_keys[index + 1], m_points[index + 1], m_keys[index], m_points[index])) {
+			std::swap(m_points[index], m_points[index + 1]);
+			std::swap(m_dead[index], m_dead[index + 1]);
+			index++;
+		}
+	}
+
+	/* returns the index of the moved point with the same coordinates as @node, -1 if there is none. Call after flush(). */
+	int64_t findMoved(const QNode<T>& node) const
+	{
+		uint64_t key = keyOf(node.x, node.y);
+		auto range = std::equal_range(m_movedKeys.begin(), m_movedKeys.end(), key);
+		for (auto it = range.first; it != range.second; ++it) {
+			size_t i = size_t(it - m_movedKeys.begin());
+			if (m_moved[i].x == node.x && m_moved[i].y == node.y) {
+				return int64_t(i);
+			}
+		}
+		return -1;
+	}
+
+	/* inserts @node at its place in the moved points, the arrays are rebuilt on the next read once there are too many. */
+	void insertMoved(uint64_t key, const QNode<T>& node)
+	{
+		size_t i = size_t(std::lower_bound(m_movedKeys.begin(), m_movedKeys.end(), key) - m_movedKeys.begin());
+		while (i < m_moved.size() && m_movedKeys[i] == key && lessThan(m_movedKeys[i], m_moved[i], key, node)) {
+			i++;
+		}
+		m_movedKeys.insert(m_movedKeys.begin() + i, key);
+		m_moved.insert(m_moved.begin() + i, node);
+		if (m_moved.size() > std::max<size_t>(256, m_keys.size() / 256)) {
+			m_dirty = true;
+		}
+	}
+
+	inline void eraseMoved(size_t index)
+	{
+		m_movedKeys.erase(m_movedKeys.begin() + index);
+		m_moved.erase(m_moved.begin() + index);
+	}
+
+	/* calls @visitor(const QNode<T>&) for every moved point whose key is in [first, last]. */
+	template<class Visitor>
+	void visitMoved(uint64_t first, uint64_t last, Visitor&& visitor) const
+	{
+		for (auto it = std::lower_bound(m_movedKeys.begin(), m_movedKeys.end(), first); it != m_movedKeys.end() && *it <= last; ++it) {
+			visitor(m_moved[size_t(it - m_movedKeys.begin())]);
+		}
+	}
+
+	/* Merges the insertion buffer and the moved points into the sorted arrays, drops dead points and duplicates, then rebuilds the nodes.
+	* O(N + M log(M)), M = num of buffered insertions.
+	*/
+	void flush() const
+	{
+		if (!m_dirty) {
+			return;
+		}
+
+		vector<uint64_t> pendingKeys(m_pending.size());
+		vector<uint32_t> order(m_pending.size());
+		for (size_t i = 0; i < m_pending.size(); ++i) {
+			pendingKeys[i] = keyOf(m_pending[i].x, m_pending[i].y);
+			order[i] = uint32_t(i);
+		}
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return lessThan(pendingKeys[a], m_pending[a], pendingKeys[b], m_pending[b]);
+		});
+
+		vector<uint64_t> keys;
+		vector<QNode<T>> points;
+		keys.reserve(m_keys.size() - m_deadCount + m_moved.size() + m_pending.size());
+		points.reserve(m_keys.size() - m_deadCount + m_moved.size() + m_pending.size());
+
+		/* by design duplicates aren't supported, the point that was already in the tree wins. */
+		auto append = [&](uint64_t key, const QNode<T>& node) {
+			if (!points.empty() && keys.back() == key && points.back().x == node.x && points.back().y == node.y) {
+				return;
+			}
+			keys.push_back(key);
+			points.push_back(node);
+		};
+
+		/* three way merge: live points (i), moved points (m), buffered insertions (j). moved points never collide with live ones. */
+		size_t i = 0, m = 0, j = 0;
+		for (;;) {
+			while (i < m_keys.size() && m_dead[i]) {
+				++i;
+			}
+			bool moved = m < m_moved.size() && (i == m_keys.size() || lessThan(m_movedKeys[m], m_moved[m], m_keys[i], m_points[i]));
+			const uint64_t* key = moved ? &m_movedKeys[m] : (i < m_keys.size() ? &m_keys[i] : nullptr);
+			const QNode<T>* point = moved ? &m_moved[m] : (i < m_keys.size() ? &m_points[i] : nullptr);
+			if (j < order.size() && (point == nullptr || lessThan(pendingKeys[order[j]], m_pending[order[j]], *key, *point))) {
+				append(pendingKeys[order[j]], m_pending[order[j]]);
+				++j;
+			}
+			else if (point != nullptr) {
+				append(*key, *point);
+				moved ? ++m : ++i;
+			}
+			else {
+				break;
+			}
+		}
+
+		m_keys.swap(keys);
+		m_points.swap(points);
+		m_dead.assign(m_keys.size(), 0);
+		m_deadCount = 0;
+		m_pending.clear();
+		m_movedKeys.clear();
+		m_moved.clear();
+
+		m_tree.clear();
+		LinearNode root = { 0, 0, 0, uint32_t(m_keys.size()), -1, 0 };
+		m_tree.push_back(root);
+		buildNode(0);
+		m_dirty = false;
+	}
+
+	/* splits node @index into 4 consecutive children if it's over capacity, children ranges are found by binary search on the keys. */
+	void buildNode(int index) const
+	{
+		LinearNode node = m_tree[index];
+		if (int64_t(node.end - node.begin) <= m_bucketCapacity || node.depth >= m_maxDepth) {
+			return;
+		}
+
+		int shift = 2 * (m_maxDepth - node.depth - 1);
+		uint32_t half = uint32_t(uint64_t(1) << (m_maxDepth - node.depth - 1));
+		uint64_t base = mortonEncode(node.cx, node.cy);
+		int first = int(m_tree.size());
+		m_tree[index].firstChild = first;
+
+		uint32_t begin = node.begin;
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			uint32_t end = node.end;
+			if (quadrant < 3) {
+				uint64_t nextKey = base + (uint64_t(quadrant + 1) << shift);
+				end = uint32_t(std::lower_bound(m_keys.begin() + begin, m_keys.begin() + node.end, nextKey) - m_keys.begin());
+			}
+			LinearNode child = { node.cx + (quadrant & 1) * half, node.cy + (quadrant >> 1) * half, begin, end, -1, node.depth + 1 };
+			m_tree.push_back(child);
+			begin = end;
+		}
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			buildNode(first + quadrant);
+		}
+	}
+
+	/* squared distance between x,y and the closest point of the node, padded by a cell so quantization can't prune a point.
+	* sides on the edge of the tree are moved to infinity, quantize() clamps points outside of the tree into the edge cells.
+	*/
+	inline float minDistSq(const LinearNode& node, float x, float y) const
+	{
+		const double inf = std::numeric_limits<double>::infinity();
+		uint64_t size = uint64_t(1) << (m_maxDepth - node.depth);
+		double x1 = node.cx == 0 ? -inf : m_x + (double(node.cx) - 1.0) * m_cellWidth;
+		double y1 = node.cy == 0 ? -inf : m_y + (double(node.cy) - 1.0) * m_cellHeight;
+		double x2 = node.cx + size == m_cells ? inf : m_x + (double(node.cx + size) + 1.0) * m_cellWidth;
+		double y2 = node.cy + size == m_cells ? inf : m_y + (double(node.cy + size) + 1.0) * m_cellHeight;
+		double dx = (x < x1) ? x1 - x : (x > x2 ? x - x2 : 0.0);
+		double dy = (y < y1) ? y1 - y : (y > y2 ? y - y2 : 0.0);
+		return float(dx * dx + dy * dy);
+	}
+
+	template<class Visitor>
+	void queryHelper(int index, const QueryRect& rect, Visitor& visitor) const
+	{
+		const LinearNode& node = m_tree[index];
+		uint32_t size = uint32_t((uint64_t(1) << (m_maxDepth - node.depth)) - 1);
+		if (node.cx > rect.cx2 || node.cx + size < rect.cx1 || node.cy > rect.cy2 || node.cy + size < rect.cy1) {
+			return;
+		}
+		if (node.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				queryHelper(node.firstChild + quadrant, rect, visitor);
+			}
+			return;
+		}
+		for (uint32_t i = node.begin; i < node.end; ++i) {
+			const QNode<T>& n = m_points[i];
+			if (!m_dead[i] && rect.x1 <= n.x && n.x <= rect.x2 && rect.y1 <= n.y && n.y <= rect.y2) {
+				visitor(n);
+			}
+		}
+	}
+
+	template<class Visitor>
+	void queryCircleHelper(int index, float cx, float cy, float radiusSq, Visitor& visitor) const
+	{
+		const LinearNode& node = m_tree[index];
+		if (minDistSq(node, cx, cy) > radiusSq) {
+			return;
+		}
+		if (node.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				queryCircleHelper(node.firstChild + quadrant, cx, cy, radiusSq, visitor);
+			}
+			return;
+		}
+		for (uint32_t i = node.begin; i < node.end; ++i) {
+			const QNode<T>& n = m_points[i];
+			float dx = n.x - cx;
+			float dy = n.y - cy;
+			if (!m_dead[i] && dx * dx + dy * dy <= radiusSq) {
+				visitor(n);
+			}
+		}
+	}
+
+	/* Best-first k nearest neighbor search, see QuadTree::nearestHelper. */
+	void nearestHelper(float x, float y, size_t k, float maxDistSq, vector<const QNode<T>*>& out) const
+	{
+		flush();
+		if (k == 0) {
+			return;
+		}
+		typedef std::pair<float, int> NodeIndexDist;
+		typedef std::pair<float, const QNode<T>*> NodeDist;
+		std::priority_queue<NodeIndexDist, vector<NodeIndexDist>, std::greater<NodeIndexDist>> pending;
+		std::priority_queue<NodeDist> best;
+
+		auto consider = [&](const QNode<T>& n) {
+			float dx = n.x - x;
+			float dy = n.y - y;
+			float distSq = dx * dx + dy * dy;
+			if (distSq > maxDistSq) {
+				return;
+			}
+			if (best.size() < k) {
+				best.emplace(distSq, &n);
+			}
+			else if (distSq < best.top().first) {
+				best.pop();
+				best.emplace(distSq, &n);
+			}
+		};
+		//moved points first, they tighten the bound before the descent.
+		for (const QNode<T>& n : m_moved) {
+			consider(n);
+		}
+
+		pending.emplace(minDistSq(m_tree[0], x, y), 0);
+		while (!pending.empty()) {
+			NodeIndexDist top = pending.top();
+			pending.pop();
+			float bound = (best.size() == k) ? best.top().first : maxDistSq;
+			if (top.first > bound) {
+				break;
+			}
+
+			const LinearNode& node = m_tree[top.second];
+			if (node.firstChild >= 0) {
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					int child = node.firstChild + quadrant;
+					float distSq = minDistSq(m_tree[child], x, y);
+					if (distSq <= maxDistSq && (best.size() < k || distSq < best.top().first)) {
+						pending.emplace(distSq, child);
+					}
+				}
+				continue;
+			}
+			for (uint32_t i = node.begin; i < node.end; ++i) {
+				if (!m_dead[i]) {
+					consider(m_points[i]);
+				}
+			}
+		}
+
+		size_t start = out.size();
+		out.resize(start + best.size());
+		for (size_t i = out.size(); i > start; --i) {
+			out[i - 1] = best.top().second;
+			best.pop();
+		}
+	}
+
+	//Member variables
+	float m_height;
+	float m_width;
+	float m_x;
+	float m_y;
+	int m_bucketCapacity;	//num of nodes per quadrant before it splits.
+	int m_maxDepth;			//max time tree can split, also the num of bits per axis in the keys.
+	uint64_t m_cells;		//num of cells per axis at max depth.
+	double m_cellWidth;
+	double m_cellHeight;
+
+	/* the arrays are rebuilt lazily by flush(), which is called from the const read functions. */
+	mutable vector<uint64_t> m_keys;		//Morton key of each point, sorted.
+	mutable vector<QNode<T>> m_points;		//points, parallel to m_keys.
+	mutable vector<uint8_t> m_dead;			//1 if the point at that index was removed.
+	mutable size_t m_deadCount;
+	mutable vector<QNode<T>> m_pending;		//insertion buffer.
+	mutable vector<uint64_t> m_movedKeys;	//keys of the points moved since the last rebuild, sorted.
+	mutable vector<QNode<T>> m_moved;		//moved points, parallel to m_movedKeys and sorted like m_points.
+	mutable vector<LinearNode> m_tree;		//node records, m_tree[0] is the root.
+	mutable bool m_dirty;					//true if the nodes have to be rebuilt before the next read.
+};
+
+template<class T> const int LinearQuadTree<T>::MAX_KEY_DEPTH;
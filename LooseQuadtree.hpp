@@ -0,0 +1,545 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Loose QuadTree for objects with an extent (QBox), QuadTree only stores points.
+*
+* Every quadrant has its usual (tight) boundaries and loose boundaries, the tight ones scaled by the looseness factor around their center.
+* An object goes to the deepest quadrant whose tight boundaries contain the center of its box and whose loose boundaries contain the whole box,
+* so each object is stored exactly once, in a leaf or in an inner quadrant when it's too large for the subtrees.
+* Queries prune quadrants by their loose boundaries, which makes the candidate set follow the actual overlap
+* instead of querying points with the radius of the largest object.
+*
+* Memory layout follows QuadTree: quadrants are index-linked records in one pool (4 subtrees are 4 consecutive records),
+* objects live in a second pool and are chained per quadrant. Handles are the index of the object in its pool, they never move.
+* Looseness of 2 is the usual choice, an object then always fits the quadrant its size calls for (at most half the width of the quadrant).
+*/
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "QNode.h"
+#include "QuadtreeRay.hpp"
+
+template<class T>
+class LooseQuadTree
+{
+public:
+	typedef int Handle;					//stable id of an object, see insert() and update()
+	static const Handle INVALID_HANDLE = -1;
+	static const int MAX_DEPTH = 24;	//float coordinates can't tell quadrants apart below 2^-24 of the root.
+
+	LooseQuadTree(const LooseQuadTree&) = delete;				//forbid copy constructor
+	LooseQuadTree& operator=(LooseQuadTree const&) = delete;	//forbid copy assignment operator
+	LooseQuadTree() = delete;									//forbid default constructor
+
+	//x1,y1 x2,y2. initially 0,0 to screen width, screen height.
+	//bucket capacity is the amount of objects a quadrant holds before it splits, objects too large for the subtrees don't count against it.
+	//@depth specifies how many times a tree can split, capped at MAX_DEPTH.
+	//@looseness scales the boundaries of every quadrant around its center, 1 makes it a regular (tight) quadtree.
+	explicit LooseQuadTree(float x1, float y1, float x2, float y2, int bucketCapacity, int depth = INT32_MAX, float looseness = 2.0f)
+	{
+		m_bucketCapacity = bucketCapacity;
+		m_maxDepth = std::max(0, std::min(depth, int(MAX_DEPTH)));
+		m_looseness = std::max(1.0f, looseness);
+		m_quads.push_back(makeQuadrant(-1, x1, y1, x2, y2, 0));
+		m_quadTop = 1;
+		m_freeQuads = -1;
+		m_freeItems = -1;
+		m_count = 0;
+	}
+
+	/* Copies @box into the tree and returns its handle.
+	* Descends while the box fits the loose boundaries of the subtree its center is in,
+	* leaves over capacity are divided, objects that don't fit any subtree stay in the divided quadrant.
+	* Boxes (partly) outside of the tree are kept in the root.
+	* O(log4(N))
+	*/
+	Handle insert(const QBox<T>& box)
+	{
+		Handle handle;
+		if (m_freeItems >= 0) {
+			handle = m_freeItems;
+			m_freeItems = m_itemNext[handle];
+			m_boxes[handle] = box;
+		}
+		else {
+			handle = Handle(m_boxes.size());
+			m_boxes.push_back(box);
+			m_itemNext.push_back(-1);
+			m_itemPrev.push_back(-1);
+			m_itemQuad.push_back(-1);
+		}
+		int q = placeHelper(0, box);
+		link(q, handle);
+		for (int p = q; p >= 0; p = m_quads[p].parent) {
+			m_quads[p].currentBucketSize++;
+		}
+		m_count++;
+		if (shouldDivide(q)) {
+			subdivide(q);
+		}
+		return handle;
+	}
+
+	/* instead of passing QBox, you can pass necessary info to create a QBox
+	* @param x1, y1:	top left corner of the box
+	* @param x2, y2:	bottom right corner of the box
+	* @param data:		data the object holds
+	*/
+	Handle insert(float x1, float y1, float x2, float y2, const T& data)
+	{
+		return insert(QBox<T>(x1, y1, x2, y2, data));
+	}
+
+	/* Moves (or resizes) the object @handle points to, to the box x1,y1 - x2,y2.
+	* If the box still belongs to the same quadrant the object is updated in place,
+	* otherwise climbs to the lowest ancestor that contains the box and only the subtrees below it are touched.
+	* returns false if @handle is invalid.
+	*/
+	bool update(Handle handle, float x1, float y1, float x2, float y2)
+	{
+		if (!isValid(handle)) {
+			return false;
+		}
+		QBox<T>& box = m_boxes[handle];
+		box.x1 = x1;
+		box.y1 = y1;
+		box.x2 = x2;
+		box.y2 = y2;
+
+		int q = m_itemQuad[handle];
+		int ancestor = q;
+		while (ancestor > 0 && !containsBox(ancestor, box)) {
+			ancestor = m_quads[ancestor].parent;
+		}
+		int target = placeHelper(ancestor, box);
+		if (target == q) {
+			return true;
+		}
+
+		unlink(handle);
+		for (int p = q; p != ancestor; p = m_quads[p].parent) {
+			m_quads[p].currentBucketSize--;
+		}
+		link(target, handle);
+		for (int p = target; p != ancestor; p = m_quads[p].parent) {
+			m_quads[p].currentBucketSize++;
+		}
+		/* bucket size of the ancestor didn't change, so the reduction stops below it and never reaches @target. */
+		removeSubtree(q);
+		if (shouldDivide(target)) {
+			subdivide(target);
+		}
+		return true;
+	}
+
+	/* removes the object @handle points to, reduces the tree if its subtrees fit in one bucket. O(log4(N)) */
+	void remove(Handle handle)
+	{
+		if (!isValid(handle)) {
+			return;
+		}
+		int q = m_itemQuad[handle];
+		unlink(handle);
+		m_itemQuad[handle] = -1;
+		m_itemNext[handle] = m_freeItems;
+		m_freeItems = handle;
+		for (int p = q; p >= 0; p = m_quads[p].parent) {
+			m_quads[p].currentBucketSize--;
+		}
+		m_count--;
+		removeSubtree(q);
+	}
+
+	/* Removes every object, O(1), pools keep their storage for the next insertions. */
+	void clear()
+	{
+		const Quadrant& root = m_quads[0];
+		m_quads[0] = makeQuadrant(-1, root.x1, root.y1, root.x2, root.y2, 0);
+		m_quadTop = 1;
+		m_freeQuads = -1;
+		m_boxes.clear();
+		m_itemNext.clear();
+		m_itemPrev.clear();
+		m_itemQuad.clear();
+		m_freeItems = -1;
+		m_count = 0;
+	}
+
+	/* Calls @visitor(const QBox<T>&) for every object whose box overlaps the rectangle x1,y1 - x2,y2 (touching counts).
+	* Quadrants whose loose boundaries don't overlap the rectangle are skipped, nothing is allocated.
+	*/
+	template<class Visitor>
+	void query(float x1, float y1, float x2, float y2, Visitor&& visitor) const
+	{
+		queryHelper(0, x1, y1, x2, y2, visitor);
+	}
+
+	/* same as above, but appends the objects found to @out instead. */
+	void query(float x1, float y1, float x2, float y2, vector<const QBox<T>*>& out) const
+	{
+		query(x1, y1, x2, y2, [&out](const QBox<T>& box) { out.push_back(&box); });
+	}
+
+	/* Returns the first object whose box is hit by the ray from ox,oy towards dx,dy within @maxDist, nullptr if there is none.
+	* Boxes are grown by @radius (a disc swept along the ray), @distance gets the distance along the ray to the box hit.
+	* Subtrees are visited front to back and the ones the ray enters past the closest hit so far are skipped.
+	*/
+	const QBox<T>* raycast(float ox, float oy, float dx, float dy, float maxDist, float radius = 0.0f, float* distance = nullptr) const
+	{
+		QuadRay ray;
+		if (!QuadRay::make(ox, oy, dx, dy, radius, ray) || !(maxDist >= 0.0f)) {
+			return nullptr;
+		}
+		const QBox<T>* best = nullptr;
+		float maxT = maxDist;
+		castHelper(0, ray, maxT, [&best](const QBox<T>& box, float t, float& limit) {
+			if (best == nullptr || t < limit) {
+				best = &box;
+				limit = t;
+			}
+		});
+		if (best != nullptr && distance != nullptr) {
+			*distance = maxT;
+		}
+		return best;
+	}
+
+	/* Calls @visitor(const QBox<T>&, float distance) for every object whose box is within @radius of the segment x1,y1 - x2,y2,
+	* distance is measured along the segment from x1,y1 to where it enters the (grown) box. Quadrants are visited front to back,
+	* but loose boundaries overlap, so the objects aren't reported in order.
+	*/
+	template<class Visitor>
+	void segmentQuery(float x1, float y1, float x2, float y2, float radius, Visitor&& visitor) const
+	{
+		QuadRay ray;
+		float maxT = std::sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+		if (!QuadRay::make(x1, y1, x2 - x1, y2 - y1, radius, ray)) {
+			//the segment is a point, any direction finds the boxes around it at 0.
+			QuadRay::make(x1, y1, 1.0f, 0.0f, radius, ray);
+			maxT = 0.0f;
+		}
+		castHelper(0, ray, maxT, [&visitor](const QBox<T>& box, float t, float&) { visitor(box, t); });
+	}
+
+	/* same as above, but appends the objects found to @out sorted from x1,y1 to x2,y2. */
+	void segmentQuery(float x1, float y1, float x2, float y2, float radius, vector<const QBox<T>*>& out) const
+	{
+		vector<std::pair<float, const QBox<T>*>> hits;
+		segmentQuery(x1, y1, x2, y2, radius, [&hits](const QBox<T>& box, float t) { hits.emplace_back(t, &box); });
+		std::stable_sort(hits.begin(), hits.end(), [](const std::pair<float, const QBox<T>*>& a, const std::pair<float, const QBox<T>*>& b) {
+			return a.first < b.first;
+		});
+		for (const std::pair<float, const QBox<T>*>& hit : hits) {
+			out.push_back(hit.second);
+		}
+	}
+
+	/* Appends every object whose box overlaps @box to @out, broad-phase candidates of @box. */
+	void getPossibleCollisions(const QBox<T>& box, vector<const QBox<T>*>& out) const
+	{
+		query(box.x1, box.y1, box.x2, box.y2, out);
+	}
+
+	/* same as above for an object in the tree, the object itself isn't reported. */
+	void getPossibleCollisions(Handle handle, vector<const QBox<T>*>& out) const
+	{
+		if (!isValid(handle)) {
+			return;
+		}
+		const QBox<T>* self = &m_boxes[handle];
+		query(self->x1, self->y1, self->x2, self->y2, [&out, self](const QBox<T>& box) {
+			if (&box != self) {
+				out.push_back(&box);
+			}
+		});
+	}
+
+	/* true if @handle points to an object that's still in the tree. */
+	inline bool isValid(Handle handle) const
+	{
+		return handle >= 0 && size_t(handle) < m_itemQuad.size() && m_itemQuad[handle] >= 0;
+	}
+
+	/* returns the object @handle points to, nullptr if the handle is invalid. */
+	const QBox<T>* getNode(Handle handle) const
+	{
+		return isValid(handle) ? &m_boxes[handle] : nullptr;
+	}
+
+	/* Getters */
+	inline float getX() const { return m_quads[0].x1; }
+	inline float getY() const { return m_quads[0].y1; }
+	inline float getWidth() const { return m_quads[0].x2; }
+	inline float getHeight() const { return m_quads[0].y2; }
+	inline float getLooseness() const { return m_looseness; }
+	inline int size() const { return m_count; }
+
+	/* bytes reserved by the pools, divide by size() to get the memory cost per object. */
+	size_t bytesUsed() const
+	{
+		return sizeof(*this) + m_quads.capacity() * sizeof(Quadrant) + m_boxes.capacity() * sizeof(QBox<T>)
+			+ (m_itemNext.capacity() + m_itemPrev.capacity() + m_itemQuad.capacity()) * sizeof(int);
+	}
+
+private:
+
+	/* A quadrant of the tree, stored by value in m_quads. subtrees are 4 consecutive records (NW, NE, SW, SE) starting at firstChild. */
+	struct Quadrant
+	{
+		float x1, y1, x2, y2;		//tight boundaries, pick the subtree of a center.
+		float lx1, ly1, lx2, ly2;	//loose boundaries, every object stored in this quadrant or its subtrees is inside them.
+		int parent;					//index of the parent quadrant, -1 for the root. non-owning.
+		int firstChild;				//index of the NW subtree, -1 if the quadrant is a leaf.
+		int currentBucketSize;		//num of objects in this quadrant and all of its subtrees.
+		int depth;
+		int firstItem;				//first object stored in this quadrant, -1 if none.
+		int size;					//num of objects stored in this quadrant.
+	};
+
+	inline Quadrant makeQuadrant(int parent, float x1, float y1, float x2, float y2, int depth) const
+	{
+		float padX = (x2 - x1) * (m_looseness - 1.0f) / 2.0f;
+		float padY = (y2 - y1) * (m_looseness - 1.0f) / 2.0f;
+		Quadrant quad = { x1, y1, x2, y2, x1 - padX, y1 - padY, x2 + padX, y2 + padY, parent, -1, 0, depth, -1, 0 };
+		return quad;
+	}
+
+	/* returns the index of 4 consecutive unused quadrants, recycled from the free list if possible. */
+	int allocQuadrants()
+	{
+		int index;
+		if (m_freeQuads >= 0) {
+			index = m_freeQuads;
+			m_freeQuads = m_quads[index].firstChild; //free blocks are chained through the first record.
+		}
+		else {
+			index = m_quadTop;
+			m_quadTop += 4;
+			if (size_t(m_quadTop) > m_quads.size()) {
+				m_quads.resize(m_quadTop);
+			}
+		}
+		return index;
+	}
+
+	inline void freeQuadrants(int index)
+	{
+		m_quads[index].firstChild = m_freeQuads;
+		m_freeQuads = index;
+	}
+
+	/* pushes object @handle to the front of the chain of @q. */
+	inline void link(int q, Handle handle)
+	{
+		Quadrant& quad = m_quads[q];
+		m_itemPrev[handle] = -1;
+		m_itemNext[handle] = quad.firstItem;
+		if (quad.firstItem >= 0) {
+			m_itemPrev[quad.firstItem] = handle;
+		}
+		quad.firstItem = handle;
+		m_itemQuad[handle] = q;
+		quad.size++;
+	}
+
+	/* takes object @handle out of the chain of its quadrant. */
+	inline void unlink(Handle handle)
+	{
+		Quadrant& quad = m_quads[m_itemQuad[handle]];
+		int prev = m_itemPrev[handle];
+		int next = m_itemNext[handle];
+		if (prev >= 0) {
+			m_itemNext[prev] = next;
+		}
+		else {
+			quad.firstItem = next;
+		}
+		if (next >= 0) {
+			m_itemPrev[next] = prev;
+		}
+		quad.size--;
+	}
+
+	/* true if @box is inside the loose boundaries of @q */
+	inline bool containsBox(int q, const QBox<T>& box) const
+	{
+		const Quadrant& quad = m_quads[q];
+		return box.x1 >= quad.lx1 && box.x2 <= quad.lx2 && box.y1 >= quad.ly1 && box.y2 <= quad.ly2;
+	}
+
+	/* returns the subtree of @q @box would go to, -1 if it doesn't fit in the subtree its center is in. @q must be divided. */
+	inline int childFor(int q, const QBox<T>& box) const
+	{
+		int child = m_quads[q].firstChild + checkQuadrant(m_quads[q], box.centerX(), box.centerY());
+		return containsBox(child, box) ? child : -1;
+	}
+
+	/* returns the deepest quadrant under @q @box can be stored in, @q must contain @box (anything fits the root). */
+	int placeHelper(int q, const QBox<T>& box) const
+	{
+		while (m_quads[q].firstChild >= 0) {
+			int child = childFor(q, box);
+			if (child < 0) {
+				break;
+			}
+			q = child;
+		}
+		return q;
+	}
+
+	inline bool shouldDivide(int q) const
+	{
+		const Quadrant& quad = m_quads[q];
+		return quad.firstChild < 0 && quad.size > m_bucketCapacity && quad.depth < m_maxDepth;
+	}
+
+	/* divides leaf @q to 4 quadrants taken from the pool and pushes down every object that fits a subtree,
+	* subtrees that are still over capacity are divided again.
+	*/
+	void subdivide(int q)
+	{
+		int first = allocQuadrants();
+		Quadrant& quad = m_quads[q];
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		int depth = quad.depth + 1;
+
+		//NW, NE, SW, SE
+		m_quads[first + NW_QUADRANT] = makeQuadrant(q, quad.x1, quad.y1, xMid, yMid, depth);
+		m_quads[first + NE_QUADRANT] = makeQuadrant(q, xMid, quad.y1, quad.x2, yMid, depth);
+		m_quads[first + SW_QUADRANT] = makeQuadrant(q, quad.x1, yMid, xMid, quad.y2, depth);
+		m_quads[first + SE_QUADRANT] = makeQuadrant(q, xMid, yMid, quad.x2, quad.y2, depth);
+		m_quads[q].firstChild = first;
+
+		for (int handle = m_quads[q].firstItem; handle >= 0;) {
+			int next = m_itemNext[handle];
+			int child = childFor(q, m_boxes[handle]);
+			if (child >= 0) {
+				unlink(handle);
+				link(child, handle);
+				m_quads[child].currentBucketSize++;
+			}
+			handle = next;
+		}
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			if (shouldDivide(first + quadrant)) {
+				subdivide(first + quadrant);
+			}
+		}
+	}
+
+	/* Should be called on the quadrant an object was removed from, bucket sizes must already be updated.
+	* Finds the highest ancestor of @tree (or @tree itself) whose subtrees hold m_bucketCapacity objects or less,
+	* moves every object below it into it and gives its subtrees back to the pool.
+	* Loose boundaries of a quadrant contain the loose boundaries of its subtrees, so the objects still fit.
+	*/
+	void removeSubtree(int tree)
+	{
+		int top = -1;
+		for (int q = tree; q >= 0 && m_quads[q].currentBucketSize <= m_bucketCapacity; q = m_quads[q].parent) {
+			top = q;
+		}
+		if (top < 0 || m_quads[top].firstChild < 0) {
+			return;
+		}
+		int first = m_quads[top].firstChild;
+		m_quads[top].firstChild = -1;
+		collapseHelper(top, first);
+	}
+
+	/* moves the objects of the 4 subtrees starting at @first (and their subtrees) to @target, frees them. */
+	void collapseHelper(int target, int first)
+	{
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			int q = first + quadrant;
+			if (m_quads[q].firstChild >= 0) {
+				collapseHelper(target, m_quads[q].firstChild);
+			}
+			while (m_quads[q].firstItem >= 0) {
+				int handle = m_quads[q].firstItem;
+				unlink(handle);
+				link(target, handle);
+			}
+		}
+		freeQuadrants(first);
+	}
+
+	template<class Visitor>
+	void queryHelper(int q, float x1, float y1, float x2, float y2, Visitor& visitor) const
+	{
+		const Quadrant& quad = m_quads[q];
+		//root keeps the objects that stick out of the tree, it's never pruned.
+		if (q != 0 && !(quad.lx1 <= x2 && x1 <= quad.lx2 && quad.ly1 <= y2 && y1 <= quad.ly2)) {
+			return;
+		}
+		for (int handle = quad.firstItem; handle >= 0; handle = m_itemNext[handle]) {
+			const QBox<T>& box = m_boxes[handle];
+			if (box.overlaps(x1, y1, x2, y2)) {
+				visitor(box);
+			}
+		}
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				queryHelper(quad.firstChild + quadrant, x1, y1, x2, y2, visitor);
+			}
+		}
+	}
+
+	/* Calls @hit(box, t, maxT) for every object @ray hits at t <= maxT, objects of inner quadrants before their subtrees.
+	* @hit can lower maxT, quadrants whose loose boundaries the ray enters past it are skipped.
+	*/
+	template<class Hit>
+	void castHelper(int q, const QuadRay& ray, float& maxT, Hit&& hit) const
+	{
+		const Quadrant& quad = m_quads[q];
+		for (int handle = quad.firstItem; handle >= 0; handle = m_itemNext[handle]) {
+			const QBox<T>& box = m_boxes[handle];
+			float t;
+			if (ray.entersBox(box.x1, box.y1, box.x2, box.y2, maxT, t)) {
+				hit(box, t, maxT);
+			}
+		}
+		if (quad.firstChild >= 0) {
+			for (int i = 0; i < 4; ++i) {
+				const Quadrant& child = m_quads[quad.firstChild + (i ^ ray.order)];
+				float t;
+				if (child.currentBucketSize > 0 && ray.entersBox(child.lx1, child.ly1, child.lx2, child.ly2, maxT, t)) {
+					castHelper(quad.firstChild + (i ^ ray.order), ray, maxT, hit);
+				}
+			}
+		}
+	}
+
+	/* return the quadrant of where x,y would be in given @quad, same as QuadTree::checkQuadrant. */
+	static inline int checkQuadrant(const Quadrant& quad, float x, float y)
+	{
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		return (x >= xMid) | ((y >= yMid) << 1);
+	}
+
+	//represents quadrants
+	enum quadrants { NW_QUADRANT = 0, NE_QUADRANT = 1, SW_QUADRANT = 2, SE_QUADRANT = 3 };
+
+	int m_bucketCapacity;
+	int m_maxDepth;
+	float m_looseness;
+
+	/* quadrant pool, m_quads[0] is the root. */
+	vector<Quadrant> m_quads;
+	int m_quadTop;
+	int m_freeQuads;			//first record of the first free group of 4 quadrants, -1 if none.
+
+	/* object pool, indexed by handle. objects of a quadrant are chained through m_itemNext / m_itemPrev. */
+	vector<QBox<T>> m_boxes;
+	vector<int> m_itemNext;
+	vector<int> m_itemPrev;
+	vector<int> m_itemQuad;		//quadrant each object is stored in, -1 for free slots.
+	int m_freeItems;			//first free slot, chained through m_itemNext. -1 if none.
+	int m_count;
+
+};
+
+template <class T> const typename LooseQuadTree<T>::Handle LooseQuadTree<T>::INVALID_HANDLE;
+template <class T> const int LooseQuadTree<T>::MAX_DEPTH;
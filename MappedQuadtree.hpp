@@ -0,0 +1,364 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Read-only QuadTree served straight from a memory-mapped file, see QuadTree::save() and QuadTree::mapReadOnly().
+*
+* The image is position independent: a header, the quadrants as flat records linked by index (4 subtrees are 4 consecutive records,
+* same as the pool of QuadTree), then the x-coordinates, the y-coordinates and the nodes of every leaf, one leaf after the other.
+* Every section starts at a multiple of QuadTreeImage::ALIGNMENT bytes, so the arrays can be used in place once the file is mapped.
+* Nothing is read or allocated when the file is mapped, the OS pages in what queries touch.
+* Nodes are stored as raw bytes, so QNode<T> must be trivially copyable, and images are only readable on machines
+* with the same byte order and sizeof(QNode<T>) as the one that wrote them (both are checked when mapping).
+* Only the header is checked, reading the records would touch the whole file. Images are trusted like any other file the program wrote itself.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <queue>
+#include <limits>
+#include <functional>
+#include <type_traits>
+#include "QNode.h"
+#include "QuadtreeSimd.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+template<class T, int Capacity, int MaxDepth> class QuadTree;
+
+/* On-disk layout shared by QuadTree::save() and MappedQuadTree. */
+struct QuadTreeImage
+{
+	enum { VERSION = 1, ALIGNMENT = 64 };
+	static const uint32_t BYTE_ORDER_MARK = 0x01020304;	//reads back differently on a machine with the other byte order.
+
+	struct Header
+	{
+		char magic[8];			//"QTREEIMG"
+		uint32_t version;
+		uint32_t byteOrder;		//BYTE_ORDER_MARK
+		uint32_t nodeSize;		//sizeof(QNode<T>) of the tree that wrote the image.
+		uint32_t quadCount;
+		uint64_t pointCount;
+		uint64_t quadOffset;	//offsets are in bytes from the start of the file.
+		uint64_t xsOffset;
+		uint64_t ysOffset;
+		uint64_t pointsOffset;
+		uint64_t fileSize;
+		int32_t bucketCapacity;
+		int32_t maxDepth;
+	};
+
+	/* a quadrant, leaves hold nodes [first, first + size) of the point arrays. */
+	struct Quad
+	{
+		float x1, y1, x2, y2;
+		int32_t firstChild;		//index of the NW subtree, -1 for leaves.
+		int32_t count;			//num of nodes in this quadrant and all of its subtrees.
+		uint32_t first;
+		uint32_t size;
+	};
+
+	static inline void setMagic(char* magic) { std::memcpy(magic, "QTREEIMG", 8); }
+	static inline bool hasMagic(const char* magic) { return std::memcmp(magic, "QTREEIMG", 8) == 0; }
+
+	/* @offset rounded up to the next multiple of ALIGNMENT */
+	static inline uint64_t align(uint64_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+};
+
+template<class T>
+class MappedQuadTree
+{
+public:
+	MappedQuadTree(const MappedQuadTree&) = delete;				//forbid copy constructor
+	MappedQuadTree& operator=(MappedQuadTree const&) = delete;	//forbid copy assignment operator
+
+	~MappedQuadTree()
+	{
+#ifdef _WIN32
+		if (m_base != nullptr) {
+			UnmapViewOfFile(m_base);
+		}
+#else
+		if (m_base != nullptr) {
+			munmap(const_cast<char*>(m_base), m_length);
+		}
+#endif
+	}
+
+	/* true if a node at @node's coordinates is in the image. O(log4(N)) to find its leaf, O(K) to scan it. */
+	bool find(const QNode<T>& node) const
+	{
+		const QuadTreeImage::Quad* quad = &m_quads[0];
+		while (quad->firstChild >= 0) {
+			float xMid = quad->x1 + (quad->x2 - quad->x1) / 2.0f;
+			float yMid = quad->y1 + (quad->y2 - quad->y1) / 2.0f;
+			quad = &m_quads[quad->firstChild + ((node.x >= xMid) | ((node.y >= yMid) << 1))];
+		}
+		for (uint32_t i = quad->first; i < quad->first + quad->size; ++i) {
+			if (m_xs[i] == node.x && m_ys[i] == node.y) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node inside the rectangle x1,y1 - x2,y2 (inclusive), same as QuadTree::query(). */
+	template<class Visitor>
+	void query(float x1, float y1, float x2, float y2, Visitor&& visitor) const
+	{
+		queryHelper(0, x1, y1, x2, y2, visitor);
+	}
+
+	/* same as above, but appends the nodes found to @out instead. Pointers point into the mapping. */
+	void query(float x1, float y1, float x2, float y2, vector<const QNode<T>*>& out) const
+	{
+		query(x1, y1, x2, y2, [&out](const QNode<T>& node) { out.push_back(&node); });
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node within @radius of cx,cy (inclusive), same as QuadTree::queryCircle(). */
+	template<class Visitor>
+	void queryCircle(float cx, float cy, float radius, Visitor&& visitor) const
+	{
+		queryCircleHelper(0, cx, cy, radius * radius, visitor);
+	}
+
+	/* same as above, but appends the nodes found to @out instead. */
+	void queryCircle(float cx, float cy, float radius, vector<const QNode<T>*>& out) const
+	{
+		queryCircle(cx, cy, radius, [&out](const QNode<T>& node) { out.push_back(&node); });
+	}
+
+	/* Appends the @k closest nodes to x,y onto @out, sorted from closest to farthest, same as QuadTree::nearest(). */
+	void nearest(float x, float y, size_t k, vector<const QNode<T>*>& out) const
+	{
+		if (k == 0) {
+			return;
+		}
+		typedef std::pair<float, int> QuadrantDist;
+		typedef std::pair<float, const QNode<T>*> NodeDist;
+		std::priority_queue<QuadrantDist, vector<QuadrantDist>, std::greater<QuadrantDist>> pending;
+		std::priority_queue<NodeDist> best;
+
+		pending.emplace(minDistSq(0, x, y), 0);
+		while (!pending.empty()) {
+			QuadrantDist top = pending.top();
+			pending.pop();
+			if (best.size() == k && top.first > best.top().first) {
+				break; //every remaining subtree is farther than the k-th best node.
+			}
+			const QuadTreeImage::Quad& quad = m_quads[top.second];
+			if (quad.firstChild >= 0) {
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					int child = quad.firstChild + quadrant;
+					float distSq = minDistSq(child, x, y);
+					if (best.size() < k || distSq < best.top().first) {
+						pending.emplace(distSq, child);
+					}
+				}
+				continue;
+			}
+			for (uint32_t i = quad.first; i < quad.first + quad.size; ++i) {
+				float dx = m_xs[i] - x;
+				float dy = m_ys[i] - y;
+				float distSq = dx * dx + dy * dy;
+				if (best.size() < k) {
+					best.emplace(distSq, &m_points[i]);
+				}
+				else if (distSq < best.top().first) {
+					best.pop();
+					best.emplace(distSq, &m_points[i]);
+				}
+			}
+		}
+
+		//best pops farthest first, fill the output from the back.
+		size_t start = out.size();
+		out.resize(start + best.size());
+		for (size_t i = out.size(); i > start; --i) {
+			out[i - 1] = best.top().second;
+			best.pop();
+		}
+	}
+
+	/* every node of the image, leaf by leaf. Pass them to QuadTree::bulkLoad() to get a tree that can be modified again. */
+	inline const QNode<T>* nodes() const { return m_points; }
+
+	/* Getters */
+	inline float getX() const { return m_quads[0].x1; }
+	inline float getY() const { return m_quads[0].y1; }
+	inline float getWidth() const { return m_quads[0].x2; }
+	inline float getHeight() const { return m_quads[0].y2; }
+	inline int getBucketCapacity() const { return m_header->bucketCapacity; }
+	inline int getMaxDepth() const { return m_header->maxDepth; }
+	inline int size() const { return m_quads[0].count; }
+
+private:
+	template<class U, int C, int D> friend class QuadTree;
+
+	MappedQuadTree() : m_base(nullptr), m_length(0), m_header(nullptr), m_quads(nullptr), m_xs(nullptr), m_ys(nullptr), m_points(nullptr) {}
+
+	/* maps @path and checks its header, returns nullptr if the file can't be mapped or isn't an image of a QuadTree<T>. */
+	static MappedQuadTree* map(const std::string& path)
+	{
+		static_assert(std::is_trivially_copyable<QNode<T>>::value, "only trees of trivially copyable nodes can be mapped");
+		MappedQuadTree* tree = new MappedQuadTree();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file != INVALID_HANDLE_VALUE) {
+			LARGE_INTEGER length;
+			if (GetFileSizeEx(file, &length) && length.QuadPart > 0) {
+				HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping != nullptr) {
+					tree->m_base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+					tree->m_length = size_t(length.QuadPart);
+					CloseHandle(mapping); //the view keeps the mapping alive.
+				}
+			}
+			CloseHandle(file);
+		}
+#else
+		int file = open(path.c_str(), O_RDONLY);
+		if (file >= 0) {
+			struct stat info;
+			if (fstat(file, &info) == 0 && info.st_size > 0) {
+				void* base = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+				if (base != MAP_FAILED) {
+					tree->m_base = static_cast<const char*>(base);
+					tree->m_length = size_t(info.st_size);
+				}
+			}
+			close(file); //the mapping stays valid after the file is closed.
+		}
+#endif
+		if (tree->m_base == nullptr || !tree->validate()) {
+			delete tree;
+			return nullptr;
+		}
+		return tree;
+	}
+
+	/* checks the header against the file and this build, and points the arrays into the mapping. */
+	bool validate()
+	{
+		if (m_length < sizeof(QuadTreeImage::Header)) {
+			return false;
+		}
+		m_header = reinterpret_cast<const QuadTreeImage::Header*>(m_base);
+		const QuadTreeImage::Header& header = *m_header;
+		if (!QuadTreeImage::hasMagic(header.magic) || header.version != QuadTreeImage::VERSION || header.byteOrder != QuadTreeImage::BYTE_ORDER_MARK
+			|| header.nodeSize != sizeof(QNode<T>) || header.fileSize != m_length || header.quadCount == 0) {
+			return false;
+		}
+		uint64_t points = header.pointCount;
+		if (!fits(header.quadOffset, uint64_t(header.quadCount) * sizeof(QuadTreeImage::Quad)) || !fits(header.xsOffset, points * sizeof(float))
+			|| !fits(header.ysOffset, points * sizeof(float)) || !fits(header.pointsOffset, points * sizeof(QNode<T>))) {
+			return false;
+		}
+		m_quads = reinterpret_cast<const QuadTreeImage::Quad*>(m_base + header.quadOffset);
+		m_xs = reinterpret_cast<const float*>(m_base + header.xsOffset);
+		m_ys = reinterpret_cast<const float*>(m_base + header.ysOffset);
+		m_points = reinterpret_cast<const QNode<T>*>(m_base + header.pointsOffset);
+		return true;
+	}
+
+	/* true if [offset, offset + bytes) is inside the file and offset is aligned, mappings start on a page so aligned offsets stay aligned. */
+	inline bool fits(uint64_t offset, uint64_t bytes) const
+	{
+		return offset % QuadTreeImage::ALIGNMENT == 0 && offset <= m_length && bytes <= m_length - offset;
+	}
+
+	/* same as QuadTree::extent(), boundaries on the edge of the tree are moved to infinity. */
+	inline void extent(int q, float& x1, float& y1, float& x2, float& y2) const
+	{
+		const QuadTreeImage::Quad& quad = m_quads[q];
+		const QuadTreeImage::Quad& root = m_quads[0];
+		const float inf = std::numeric_limits<float>::infinity();
+		x1 = quad.x1 == root.x1 ? -inf : quad.x1;
+		y1 = quad.y1 == root.y1 ? -inf : quad.y1;
+		x2 = quad.x2 == root.x2 ? inf : quad.x2;
+		y2 = quad.y2 == root.y2 ? inf : quad.y2;
+	}
+
+	inline bool overlaps(int q, float x1, float y1, float x2, float y2) const
+	{
+		float qx1, qy1, qx2, qy2;
+		extent(q, qx1, qy1, qx2, qy2);
+		return x1 <= qx2 && qx1 <= x2 && y1 <= qy2 && qy1 <= y2;
+	}
+
+	inline float minDistSq(int q, float x, float y) const
+	{
+		float qx1, qy1, qx2, qy2;
+		extent(q, qx1, qy1, qx2, qy2);
+		float dx = (x < qx1) ? qx1 - x : (x > qx2 ? x - qx2 : 0.0f);
+		float dy = (y < qy1) ? qy1 - y : (y > qy2 ? y - qy2 : 0.0f);
+		return dx * dx + dy * dy;
+	}
+
+	template<class Visitor>
+	void queryHelper(int q, float x1, float y1, float x2, float y2, Visitor& visitor) const
+	{
+		const QuadTreeImage::Quad& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				if (overlaps(quad.firstChild + quadrant, x1, y1, x2, y2)) {
+					queryHelper(quad.firstChild + quadrant, x1, y1, x2, y2, visitor);
+				}
+			}
+			return;
+		}
+		int hits[QuadSimd::CHUNK];
+		uint32_t end = quad.first + quad.size;
+		for (uint32_t offset = quad.first; offset < end; offset += QuadSimd::CHUNK) {
+			int found = QuadSimd::filterRect(m_xs + offset, m_ys + offset, std::min<int>(QuadSimd::CHUNK, int(end - offset)), x1, y1, x2, y2, hits);
+			for (int i = 0; i < found; ++i) {
+				visitor(m_points[offset + hits[i]]);
+			}
+		}
+	}
+
+	template<class Visitor>
+	void queryCircleHelper(int q, float cx, float cy, float radiusSq, Visitor& visitor) const
+	{
+		const QuadTreeImage::Quad& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				if (minDistSq(quad.firstChild + quadrant, cx, cy) <= radiusSq) {
+					queryCircleHelper(quad.firstChild + quadrant, cx, cy, radiusSq, visitor);
+				}
+			}
+			return;
+		}
+		int hits[QuadSimd::CHUNK];
+		uint32_t end = quad.first + quad.size;
+		for (uint32_t offset = quad.first; offset < end; offset += QuadSimd::CHUNK) {
+			int found = QuadSimd::filterCircle(m_xs + offset, m_ys + offset, std::min<int>(QuadSimd::CHUNK, int(end - offset)), cx, cy, radiusSq, hits);
+			for (int i = 0; i < found; ++i) {
+				visitor(m_points[offset + hits[i]]);
+			}
+		}
+	}
+
+	const char* m_base;		//start of the mapping, nullptr if nothing is mapped.
+	size_t m_length;
+	const QuadTreeImage::Header* m_header;
+	const QuadTreeImage::Quad* m_quads;
+	const float* m_xs;
+	const float* m_ys;
+	const QNode<T>* m_points;
+};
@@ -0,0 +1,783 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Out-of-core QuadTree for point sets that don't fit in memory, see PagedQuadTree::create().
+*
+* Quadrants stay in memory (a few dozen bytes per leaf), the buckets of the leaves live in fixed-size pages of a local file.
+* A page holds the x-coordinates, the y-coordinates and the nodes of one leaf (same split as QuadTree's buckets, so scans use QuadSimd),
+* a leaf that can't be divided (see needsSplit()) chains more pages. Points outside of the tree are kept in the edge leaves like QuadTree. Pages are read through an LRU cache of a fixed num of pages,
+* modified pages are written back when they're evicted or on flush().
+* Range queries list the leaves they overlap first, then read the pages missing from the cache a window at a time,
+* sorted by page and in runs of consecutive pages, so a scan turns into a few large sequential reads instead of one seek per leaf.
+* A divided leaf keeps its page for its NW subtree and the other 3 subtrees get consecutive pages, nearby leaves end up nearby in the file.
+*
+* The file is scratch space for one tree: it's truncated when the tree is created and deleted with it (removed from the directory
+* right away on POSIX), the quadrants needed to read it back only exist in memory. Nodes are stored as raw bytes, so QNode<T> must be
+* trivially copyable, like for QuadTree::save(). Queries go through the cache, so nothing here is safe to call from several threads at once.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include "QNode.h"
+#include "QuadtreeSimd.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* page traffic of a PagedQuadTree since it was created or resetPageStats() was called */
+struct PagedQuadTreeStats
+{
+	uint64_t hits;			//page accesses served by the cache.
+	uint64_t misses;		//page accesses that had to read the page (prefetched pages aren't misses).
+	uint64_t reads;			//read calls, a run of prefetched pages is one call.
+	uint64_t pagesRead;
+	uint64_t pagesWritten;	//dirty pages written back.
+	uint64_t prefetched;	//pages read ahead by range queries.
+	size_t pages;			//pages in the file.
+	size_t cachePages;
+};
+
+/* Local file of fixed-size pages, reads and writes at offsets. */
+class QuadPageFile
+{
+public:
+	QuadPageFile(const QuadPageFile&) = delete;				//forbid copy constructor
+	QuadPageFile& operator=(QuadPageFile const&) = delete;	//forbid copy assignment operator
+
+	QuadPageFile() :
+#ifdef _WIN32
+		m_file(INVALID_HANDLE_VALUE)
+#else
+		m_file(-1)
+#endif
+	{}
+
+	~QuadPageFile()
+	{
+#ifdef _WIN32
+		if (m_file != INVALID_HANDLE_VALUE) {
+			CloseHandle(m_file);
+		}
+#else
+		if (m_file >= 0) {
+			close(m_file);
+		}
+#endif
+	}
+
+	/* creates (or truncates) @path, the file is deleted when it's closed. false if it can't be created. */
+	bool open(const std::string& path)
+	{
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		return m_file != INVALID_HANDLE_VALUE;
+#else
+		m_file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (m_file < 0) {
+			return false;
+		}
+		unlink(path.c_str()); //the open descriptor keeps the file alive, nothing is left behind if the process dies.
+		return true;
+#endif
+	}
+
+	bool read(uint64_t offset, void* data, size_t bytes)
+	{
+		char* out = static_cast<char*>(data);
+		while (bytes > 0) {
+#ifdef _WIN32
+			OVERLAPPED at = {};
+			at.Offset = DWORD(offset);
+			at.OffsetHigh = DWORD(offset >> 32);
+			DWORD done = 0;
+			if (!ReadFile(m_file, out, DWORD(std::min<size_t>(bytes, 1u << 30)), &done, &at)) {
+				return false;
+			}
+#else
+			ssize_t done = pread(m_file, out, bytes, off_t(offset));
+			if (done < 0) {
+				return false;
+			}
+#endif
+			if (done == 0) {
+				//past the end of the file: pages that were never written back read as zeros.
+				std::memset(out, 0, bytes);
+				return true;
+			}
+			out += done;
+			offset += uint64_t(done);
+			bytes -= size_t(done);
+		}
+		return true;
+	}
+
+	bool write(uint64_t offset, const void* data, size_t bytes)
+	{
+		const char* in = static_cast<const char*>(data);
+		while (bytes > 0) {
+#ifdef _WIN32
+			OVERLAPPED at = {};
+			at.Offset = DWORD(offset);
+			at.OffsetHigh = DWORD(offset >> 32);
+			DWORD done = 0;
+			if (!WriteFile(m_file, in, DWORD(std::min<size_t>(bytes, 1u << 30)), &done, &at) || done == 0) {
+				return false;
+			}
+#else
+			ssize_t done = pwrite(m_file, in, bytes, off_t(offset));
+			if (done <= 0) {
+				return false;
+			}
+#endif
+			in += done;
+			offset += uint64_t(done);
+			bytes -= size_t(done);
+		}
+		return true;
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE m_file;
+#else
+	int m_file;
+#endif
+};
+
+template<class T>
+class PagedQuadTree
+{
+public:
+	PagedQuadTree(const PagedQuadTree&) = delete;				//forbid copy constructor
+	PagedQuadTree& operator=(PagedQuadTree const&) = delete;	//forbid copy assignment operator
+
+	static const size_t DEFAULT_PAGE_SIZE = 4096;
+	static const size_t DEFAULT_PREFETCH = 32;	//pages read ahead by range queries, see setPrefetch().
+
+	/* Creates an empty tree x1,y1 - x2,y2 whose buckets live in the file @path, returns nullptr if the file can't be created.
+	* @cachePages pages of @pageSize bytes are kept in memory (at least 4). A leaf splits when its page is full,
+	* so the bucket capacity is the num of nodes that fit in a page, see getBucketCapacity().
+	* @depth specifies how many times the tree can split, leaves at max depth (or whose nodes can't be separated) chain more pages.
+	*/
+	static std::unique_ptr<PagedQuadTree> create(const std::string& path, float x1, float y1, float x2, float y2,
+		size_t cachePages, size_t pageSize = DEFAULT_PAGE_SIZE, int depth = INT32_MAX)
+	{
+		static_assert(std::is_trivially_copyable<QNode<T>>::value, "only trees of trivially copyable nodes can be paged");
+		static_assert(alignof(QNode<T>) <= sizeof(uint64_t), "nodes are stored at 8 byte boundaries of a page");
+		std::unique_ptr<PagedQuadTree> tree(new PagedQuadTree(x1, y1, x2, y2, cachePages, pageSize, depth));
+		if (tree->m_capacity < 1 || !tree->m_file.open(path)) {
+			return nullptr;
+		}
+		return tree;
+	}
+
+	/* Copies x,y,data into the leaf it belongs to, returns false if a node already sits at x,y or a page couldn't be read or written
+	* during the call (pages evicted to make room included), good() is false from then on.
+	* A full leaf is divided first: its nodes are read once and written to the pages of its 4 subtrees.
+	* O(log4(N)) in memory to find the leaf, then 1 page access (plus the pages of a chain, see needsSplit()).
+	*/
+	bool insert(float x, float y, const T& data)
+	{
+		bool failed = m_failed; //m_failed never goes back to false, it differs only if this call failed.
+		int leaf = leafHelper(x, y);
+		if (findInLeaf(leaf, x, y, nullptr) || m_failed != failed) {
+			return false;
+		}
+		while (needsSplit(leaf)) {
+			if (!subdivide(leaf)) {
+				return false;
+			}
+			leaf = m_quads[leaf].firstChild + checkQuadrant(m_quads[leaf], x, y);
+		}
+		if (!append(leaf, QNode<T>(x, y, data))) {
+			return false;
+		}
+		for (int q = leaf; q >= 0; q = m_quads[q].parent) {
+			m_quads[q].count++;
+		}
+		return m_failed == failed;
+	}
+
+	/* same as above, @node is copied into the tree. */
+	bool insert(const QNode<T>& node)
+	{
+		return insert(node.x, node.y, node.m_data);
+	}
+
+	/* true if a node at @node's coordinates is in the tree, its payload is copied to @data if it isn't nullptr.
+	* false if its page couldn't be read, good() tells the two apart.
+	* O(log4(N)) in memory to find the leaf, then 1 page access.
+	*/
+	bool find(const QNode<T>& node, T* data = nullptr)
+	{
+		return findInLeaf(leafHelper(node.x, node.y), node.x, node.y, data);
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node inside the rectangle x1,y1 - x2,y2 (inclusive), same as QuadTree::query().
+	* The node points into the cache, it's only valid until @visitor returns, and @visitor must not call the tree.
+	* Leaves are collected first, then visited in order while the pages of the next getPrefetch() leaves are read ahead.
+	* Stops at the first page that can't be read, good() is false then.
+	*/
+	template<class Visitor>
+	void query(float x1, float y1, float x2, float y2, Visitor&& visitor)
+	{
+		m_scan.clear();
+		collectLeaves(0, x1, y1, x2, y2);
+		int hits[QuadSimd::CHUNK];
+		for (size_t i = 0; i < m_scan.size(); ++i) {
+			if (m_prefetch > 0 && i % m_prefetch == 0) {
+				prefetch(i, std::min(m_scan.size(), i + m_prefetch));
+			}
+			for (int page = m_quads[m_scan[i]].firstPage; page >= 0;) {
+				const char* data = pageData(page, false);
+				if (data == nullptr) {
+					return;
+				}
+				const PageHeader& header = *reinterpret_cast<const PageHeader*>(data);
+				const float* xs = xsOf(data);
+				const float* ys = ysOf(data);
+				const QNode<T>* nodes = nodesOf(data);
+				for (int offset = 0; offset < header.count; offset += QuadSimd::CHUNK) {
+					int found = QuadSimd::filterRect(xs + offset, ys + offset, std::min<int>(QuadSimd::CHUNK, header.count - offset), x1, y1, x2, y2, hits);
+					for (int j = 0; j < found; ++j) {
+						visitor(nodes[offset + hits[j]]);
+					}
+				}
+				page = header.next;
+			}
+		}
+	}
+
+	/* same as above, but appends copies of the nodes found to @out instead. */
+	void query(float x1, float y1, float x2, float y2, vector<QNode<T>>& out)
+	{
+		query(x1, y1, x2, y2, [&out](const QNode<T>& node) { out.push_back(node); });
+	}
+
+	/* writes every modified page of the cache back to the file, in page order. false if a write failed. */
+	bool flush()
+	{
+		vector<int> dirty;
+		for (size_t f = 0; f < m_frames.size(); ++f) {
+			if (m_frames[f].page >= 0 && m_frames[f].dirty) {
+				dirty.push_back(int(f));
+			}
+		}
+		std::sort(dirty.begin(), dirty.end(), [this](int a, int b) { return m_frames[a].page < m_frames[b].page; });
+		bool ok = true;
+		for (int f : dirty) {
+			ok = writeBack(f) && ok;
+		}
+		return ok;
+	}
+
+	/* Leaves visited by a range query past which pages are read ahead, 0 turns read-ahead off.
+	* Capped to half the cache, pages read ahead must still be there when the query gets to them.
+	*/
+	void setPrefetch(size_t pages)
+	{
+		m_prefetch = std::min(pages, m_frames.size() / 2);
+	}
+
+	PagedQuadTreeStats pageStats() const
+	{
+		PagedQuadTreeStats stats = m_stats;
+		stats.pages = size_t(m_pageCount);
+		stats.cachePages = m_frames.size();
+		return stats;
+	}
+
+	void resetPageStats()
+	{
+		m_stats = PagedQuadTreeStats();
+	}
+
+	/* false once a page couldn't be read or written, the tree can't be trusted from then on and every page access fails. */
+	inline bool good() const { return !m_failed; }
+
+	/* Getters */
+	inline float getX() const { return m_quads[0].x1; }
+	inline float getY() const { return m_quads[0].y1; }
+	inline float getWidth() const { return m_quads[0].x2; }
+	inline float getHeight() const { return m_quads[0].y2; }
+	inline int getBucketCapacity() const { return m_capacity; }
+	inline int getMaxDepth() const { return m_maxDepth; }
+	inline size_t getPageSize() const { return m_pageSize; }
+	inline size_t getPrefetch() const { return m_prefetch; }
+	inline int size() const { return m_quads[0].count; }
+
+	/* bytes kept in memory: quadrants, page table and the cache. */
+	size_t bytesUsed() const
+	{
+		return sizeof(*this) + m_quads.capacity() * sizeof(Quadrant) + m_frames.capacity() * sizeof(Frame) + m_frameData.capacity() * sizeof(uint64_t)
+			+ m_pageFrame.capacity() * sizeof(int) + (m_scan.capacity() + m_missing.capacity()) * sizeof(int)
+			+ m_readBuffer.capacity() * sizeof(uint64_t) + m_split.capacity() * sizeof(QNode<T>)
+			+ (m_chain.capacity() + m_freePages.capacity()) * sizeof(int);
+	}
+
+	/* bytes of the file, pages of the cache that were never written back included. */
+	inline uint64_t fileBytes() const { return uint64_t(m_pageCount) * m_pageSize; }
+
+private:
+	/* A quadrant, kept in memory. subtrees are 4 consecutive records (NW, NE, SW, SE) starting at firstChild. */
+	struct Quadrant
+	{
+		float x1, y1, x2, y2;	//boundaries, x2,y2 are the coordinates of the bottom right corner.
+		int parent;				//index of the parent quadrant, -1 for the root.
+		int firstChild;			//index of the NW subtree, -1 if the quadrant is a leaf.
+		int count;				//num of nodes in this quadrant and all of its subtrees.
+		int depth;
+		int firstPage;			//first page of the leaf, -1 for inner quadrants.
+		int lastPage;			//last page of the chain, new nodes are appended there.
+		int size;				//num of nodes in the leaf.
+	};
+
+	/* start of every page, followed by the x-coordinates, the y-coordinates and the nodes of the leaf. */
+	struct PageHeader
+	{
+		int32_t count;			//num of nodes in this page.
+		int32_t next;			//next page of the chain, -1 if none.
+	};
+
+	/* a page of the cache, frames are linked from the most to the least recently used. */
+	struct Frame
+	{
+		int page;				//page held by the frame, -1 if none.
+		int prev, next;
+		bool dirty;
+	};
+
+	PagedQuadTree(float x1, float y1, float x2, float y2, size_t cachePages, size_t pageSize, int depth)
+	{
+		//8 byte multiples keep the nodes of every page aligned.
+		m_pageSize = std::max<size_t>((pageSize + 7) / 8 * 8, 64);
+		m_pageWords = m_pageSize / sizeof(uint64_t);
+		//x + y + node per slot, the nodes start at the next 8 byte boundary after the coordinates.
+		m_capacity = int((m_pageSize - sizeof(PageHeader) - sizeof(uint64_t)) / (2 * sizeof(float) + sizeof(QNode<T>)));
+		m_maxDepth = std::max(0, depth);
+		m_prefetch = 0;
+		m_pageCount = 0;
+		m_failed = false;
+		m_mru = m_lru = -1;
+		m_stats = PagedQuadTreeStats();
+
+		size_t frames = std::max<size_t>(cachePages, 4);
+		m_frames.resize(frames);
+		m_frameData.resize(frames * m_pageWords);
+		for (size_t f = 0; f < frames; ++f) {
+			m_frames[f].page = -1;
+			m_frames[f].dirty = false;
+			m_frames[f].prev = m_frames[f].next = -1;
+			linkFront(int(f));
+		}
+		setPrefetch(DEFAULT_PREFETCH);
+
+		Quadrant root = { x1, y1, x2, y2, -1, -1, 0, 0, -1, -1, 0 };
+		m_quads.push_back(root);
+		if (m_capacity >= 1) {
+			m_quads[0].firstPage = m_quads[0].lastPage = newPage();
+		}
+	}
+
+	/* page layout, see PageHeader */
+	inline const float* xsOf(const char* data) const { return reinterpret_cast<const float*>(data + sizeof(PageHeader)); }
+	inline const float* ysOf(const char* data) const { return xsOf(data) + m_capacity; }
+	inline float* xsOf(char* data) const { return reinterpret_cast<float*>(data + sizeof(PageHeader)); }
+	inline float* ysOf(char* data) const { return xsOf(data) + m_capacity; }
+	inline size_t nodesOffset() const { return (sizeof(PageHeader) + 2 * sizeof(float) * m_capacity + 7) / 8 * 8; }
+	inline const QNode<T>* nodesOf(const char* data) const { return reinterpret_cast<const QNode<T>*>(data + nodesOffset()); }
+	inline QNode<T>* nodesOf(char* data) const { return reinterpret_cast<QNode<T>*>(data + nodesOffset()); }
+
+	inline char* frameData(int f) { return reinterpret_cast<char*>(&m_frameData[size_t(f) * m_pageWords]); }
+
+	/* same as QuadTree::checkQuadrant */
+	static inline int checkQuadrant(const Quadrant& quad, float x, float y)
+	{
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		return (x >= xMid) | ((y >= yMid) << 1);
+	}
+
+	/* same as QuadTree::extent(), boundaries on the edge of the tree are moved to infinity. */
+	inline void extent(int q, float& x1, float& y1, float& x2, float& y2) const
+	{
+		const Quadrant& quad = m_quads[q];
+		const Quadrant& root = m_quads[0];
+		const float inf = std::numeric_limits<float>::infinity();
+		x1 = quad.x1 == root.x1 ? -inf : quad.x1;
+		y1 = quad.y1 == root.y1 ? -inf : quad.y1;
+		x2 = quad.x2 == root.x2 ? inf : quad.x2;
+		y2 = quad.y2 == root.y2 ? inf : quad.y2;
+	}
+
+	/* True if leaf @q is full and dividing it can separate its nodes, same rules as QuadTree::needsSplit():
+	* not at max depth, the midpoints can still move, and not every node is outside of @q in the same subtree.
+	* Reads the pages of the leaf, false if they can't be read.
+	*/
+	bool needsSplit(int q)
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.size < m_capacity || quad.depth >= m_maxDepth) {
+			return false;
+		}
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		if (!(quad.x1 < xMid && xMid < quad.x2 && quad.y1 < yMid && yMid < quad.y2)) {
+			return false;
+		}
+		int corner = -1;
+		for (int page = quad.firstPage; page >= 0;) {
+			const char* bytes = pageData(page, false);
+			if (bytes == nullptr) {
+				return false;
+			}
+			const PageHeader& header = *reinterpret_cast<const PageHeader*>(bytes);
+			const float* xs = xsOf(bytes);
+			const float* ys = ysOf(bytes);
+			for (int i = 0; i < header.count; ++i) {
+				int quadrant = checkQuadrant(quad, xs[i], ys[i]);
+				bool inside = xs[i] >= quad.x1 && xs[i] <= quad.x2 && ys[i] >= quad.y1 && ys[i] <= quad.y2;
+				if (inside || (corner >= 0 && quadrant != corner)) {
+					return true;
+				}
+				corner = quadrant;
+			}
+			page = header.next;
+		}
+		return false;
+	}
+
+	int leafHelper(float x, float y) const
+	{
+		int q = 0;
+		while (m_quads[q].firstChild >= 0) {
+			q = m_quads[q].firstChild + checkQuadrant(m_quads[q], x, y);
+		}
+		return q;
+	}
+
+	bool findInLeaf(int leaf, float x, float y, T* data)
+	{
+		for (int page = m_quads[leaf].firstPage; page >= 0;) {
+			const char* bytes = pageData(page, false);
+			if (bytes == nullptr) {
+				return false;
+			}
+			const PageHeader& header = *reinterpret_cast<const PageHeader*>(bytes);
+			const float* xs = xsOf(bytes);
+			const float* ys = ysOf(bytes);
+			for (int i = 0; i < header.count; ++i) {
+				if (xs[i] == x && ys[i] == y) {
+					if (data != nullptr) {
+						*data = nodesOf(bytes)[i].m_data;
+					}
+					return true;
+				}
+			}
+			page = header.next;
+		}
+		return false;
+	}
+
+	/* appends @node to the last page of @leaf, a new page is chained when it's full. */
+	bool append(int leaf, const QNode<T>& node)
+	{
+		Quadrant& quad = m_quads[leaf];
+		char* bytes = pageData(quad.lastPage, true);
+		if (bytes == nullptr) {
+			return false;
+		}
+		PageHeader* header = reinterpret_cast<PageHeader*>(bytes);
+		if (header->count >= m_capacity) {
+			int page = newPage();
+			header->next = page; //still in the cache, newPage() only evicts after writing the old page back.
+			quad.lastPage = page;
+			bytes = pageData(page, true);
+			if (bytes == nullptr) {
+				return false;
+			}
+			header = reinterpret_cast<PageHeader*>(bytes);
+		}
+		int i = header->count++;
+		xsOf(bytes)[i] = node.x;
+		ysOf(bytes)[i] = node.y;
+		std::memcpy(static_cast<void*>(&nodesOf(bytes)[i]), &node, sizeof(QNode<T>));
+		quad.size++;
+		return true;
+	}
+
+	/* Divides leaf @q, its page goes to the NW subtree and the other 3 subtrees get 3 consecutive new pages
+	* (the rest of its chain first, if it's a leaf that couldn't be divided before).
+	* false if a page couldn't be read or written, the leaf is left as is if its pages couldn't be read.
+	*/
+	bool subdivide(int q)
+	{
+		int first = int(m_quads.size());
+		Quadrant quad = m_quads[q];
+		m_split.clear();
+		m_chain.clear();
+		for (int page = quad.firstPage; page >= 0;) {
+			const char* bytes = pageData(page, false);
+			if (bytes == nullptr) {
+				return false;
+			}
+			const PageHeader& header = *reinterpret_cast<const PageHeader*>(bytes);
+			const QNode<T>* nodes = nodesOf(bytes);
+			m_split.insert(m_split.end(), nodes, nodes + header.count);
+			m_chain.push_back(page);
+			page = header.next;
+		}
+		char* bytes = pageData(quad.firstPage, true);
+		if (bytes == nullptr) {
+			return false;
+		}
+		PageHeader* header = reinterpret_cast<PageHeader*>(bytes);
+		header->count = 0;
+		header->next = -1;
+		//newPage() hands out the rest of the chain first, in chain order.
+		m_freePages.insert(m_freePages.end(), m_chain.rbegin(), m_chain.rend() - 1);
+
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		int depth = quad.depth + 1;
+		Quadrant children[4] = {
+			{ quad.x1, quad.y1, xMid, yMid, q, -1, 0, depth, -1, -1, 0 },
+			{ xMid, quad.y1, quad.x2, yMid, q, -1, 0, depth, -1, -1, 0 },
+			{ quad.x1, yMid, xMid, quad.y2, q, -1, 0, depth, -1, -1, 0 },
+			{ xMid, yMid, quad.x2, quad.y2, q, -1, 0, depth, -1, -1, 0 }
+		};
+		m_quads.insert(m_quads.end(), children, children + 4);
+		m_quads[first].firstPage = m_quads[first].lastPage = quad.firstPage;
+		for (int quadrant = 1; quadrant < 4; ++quadrant) {
+			m_quads[first + quadrant].firstPage = m_quads[first + quadrant].lastPage = newPage();
+		}
+		m_quads[q].firstChild = first;
+		m_quads[q].firstPage = m_quads[q].lastPage = -1;
+		m_quads[q].size = 0;
+		for (const QNode<T>& node : m_split) {
+			int child = first + checkQuadrant(quad, node.x, node.y);
+			if (!append(child, node)) {
+				return false;
+			}
+			m_quads[child].count++;
+		}
+		return true;
+	}
+
+	/* appends every non-empty leaf whose extent() overlaps x1,y1 - x2,y2 to m_scan, in NW, NE, SW, SE order. */
+	void collectLeaves(int q, float x1, float y1, float x2, float y2)
+	{
+		const Quadrant& quad = m_quads[q];
+		float qx1, qy1, qx2, qy2;
+		extent(q, qx1, qy1, qx2, qy2);
+		if (quad.count == 0 || !(x1 <= qx2 && qx1 <= x2 && y1 <= qy2 && qy1 <= y2)) {
+			return;
+		}
+		if (quad.firstChild < 0) {
+			m_scan.push_back(q);
+			return;
+		}
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			collectLeaves(quad.firstChild + quadrant, x1, y1, x2, y2);
+		}
+	}
+
+	/* reads the pages of leaves m_scan[first, last) that aren't cached, sorted, one read per run of consecutive pages. */
+	void prefetch(size_t first, size_t last)
+	{
+		m_missing.clear();
+		//only first pages: the rest of a chain is only known once the page before it is read.
+		for (size_t i = first; i < last && m_missing.size() < m_prefetch; ++i) {
+			int page = m_quads[m_scan[i]].firstPage;
+			if (m_pageFrame[page] < 0) {
+				m_missing.push_back(page);
+			}
+		}
+		std::sort(m_missing.begin(), m_missing.end());
+		m_readBuffer.resize(m_prefetch * m_pageWords);
+		char* buffer = reinterpret_cast<char*>(m_readBuffer.data());
+		for (size_t start = 0; start < m_missing.size();) {
+			size_t end = start + 1;
+			while (end < m_missing.size() && m_missing[end] == m_missing[end - 1] + 1) {
+				end++;
+			}
+			if (!m_file.read(uint64_t(m_missing[start]) * m_pageSize, buffer, (end - start) * m_pageSize)) {
+				m_failed = true;
+				return;
+			}
+			m_stats.reads++;
+			for (size_t i = start; i < end; ++i) {
+				int f = takeFrame(m_missing[i]);
+				std::memcpy(frameData(f), buffer + (i - start) * m_pageSize, m_pageSize);
+			}
+			m_stats.pagesRead += end - start;
+			m_stats.prefetched += end - start;
+			start = end;
+		}
+	}
+
+	/* Returns the bytes of @page in the cache, reading it if it isn't there, nullptr if it couldn't be read.
+	* @write marks it modified. The pointer is valid until the next page access, which can evict it.
+	* Once a page couldn't be read or written, every access fails: a page lost by a write reads back as garbage chains.
+	*/
+	char* pageData(int page, bool write)
+	{
+		if (m_failed) {
+			return nullptr;
+		}
+		int f = m_pageFrame[page];
+		if (f >= 0) {
+			m_stats.hits++;
+			unlink(f);
+			linkFront(f);
+		}
+		else {
+			m_stats.misses++;
+			f = takeFrame(page);
+			if (!m_file.read(uint64_t(page) * m_pageSize, frameData(f), m_pageSize)) {
+				//the frame holds garbage, it mustn't be found by the next access to @page.
+				m_pageFrame[page] = -1;
+				m_frames[f].page = -1;
+				m_failed = true;
+				return nullptr;
+			}
+			m_stats.reads++;
+			m_stats.pagesRead++;
+		}
+		m_frames[f].dirty = m_frames[f].dirty || write;
+		return frameData(f);
+	}
+
+	/* returns a new empty page, a page given back by subdivide() or one at the end of the file, only in the cache until it's written back. */
+	int newPage()
+	{
+		int page;
+		if (!m_freePages.empty()) {
+			page = m_freePages.back();
+			m_freePages.pop_back();
+		}
+		else {
+			page = m_pageCount++;
+			m_pageFrame.push_back(-1);
+		}
+		int f = m_pageFrame[page];
+		if (f >= 0) {
+			unlink(f);
+			linkFront(f);
+		}
+		else {
+			f = takeFrame(page);
+		}
+		char* bytes = frameData(f);
+		std::memset(bytes, 0, m_pageSize);
+		PageHeader* header = reinterpret_cast<PageHeader*>(bytes);
+		header->count = 0;
+		header->next = -1;
+		m_frames[f].dirty = true;
+		return page;
+	}
+
+	/* evicts the least recently used frame (writing it back if needed) and gives it to @page, as the most recently used. */
+	int takeFrame(int page)
+	{
+		int f = m_lru;
+		if (m_frames[f].page >= 0) {
+			if (m_frames[f].dirty && !writeBack(f)) {
+				m_failed = true;
+			}
+			m_pageFrame[m_frames[f].page] = -1;
+		}
+		m_frames[f].page = page;
+		m_frames[f].dirty = false;
+		m_pageFrame[page] = f;
+		unlink(f);
+		linkFront(f);
+		return f;
+	}
+
+	bool writeBack(int f)
+	{
+		m_stats.pagesWritten++;
+		m_frames[f].dirty = false;
+		return m_file.write(uint64_t(m_frames[f].page) * m_pageSize, frameData(f), m_pageSize);
+	}
+
+	void unlink(int f)
+	{
+		Frame& frame = m_frames[f];
+		if (frame.prev >= 0) {
+			m_frames[frame.prev].next = frame.next;
+		}
+		else {
+			m_mru = frame.next;
+		}
+		if (frame.next >= 0) {
+			m_frames[frame.next].prev = frame.prev;
+		}
+		else {
+			m_lru = frame.prev;
+		}
+		frame.prev = frame.next = -1;
+	}
+
+	void linkFront(int f)
+	{
+		Frame& frame = m_frames[f];
+		frame.prev = -1;
+		frame.next = m_mru;
+		if (m_mru >= 0) {
+			m_frames[m_mru].prev = f;
+		}
+		m_mru = f;
+		if (m_lru < 0) {
+			m_lru = f;
+		}
+	}
+
+	size_t m_pageSize;
+	size_t m_pageWords;			//m_pageSize in 8 byte words.
+	int m_capacity;				//nodes per page.
+	int m_maxDepth;
+	size_t m_prefetch;
+	bool m_failed;
+
+	/* quadrant pool, m_quads[0] is the root. */
+	vector<Quadrant> m_quads;
+
+	/* page cache, m_frameData holds the bytes of every frame one after the other. */
+	QuadPageFile m_file;
+	int m_pageCount;
+	vector<int> m_pageFrame;	//frame holding each page, -1 if it isn't cached.
+	vector<Frame> m_frames;
+	vector<uint64_t> m_frameData;
+	int m_mru, m_lru;
+	PagedQuadTreeStats m_stats;
+
+	/* scratch arrays kept between calls */
+	vector<int> m_scan;			//leaves a range query visits.
+	vector<int> m_missing;		//pages a prefetch reads.
+	vector<uint64_t> m_readBuffer;
+	vector<QNode<T>> m_split;	//nodes of the leaf being divided.
+	vector<int> m_chain;		//pages of the leaf being divided.
+	vector<int> m_freePages;	//pages of divided chains that no leaf uses, reused by newPage().
+};
+
+template<class T> const size_t PagedQuadTree<T>::DEFAULT_PAGE_SIZE;
+template<class T> const size_t PagedQuadTree<T>::DEFAULT_PREFETCH;
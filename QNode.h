@@ -15,18 +15,18 @@
 #include <algorithm>
 
 using namespace std;
-template<class T>
+template<class T, class Coord = float>	//Coord is an integer type for GridQuadTree, float everywhere else.
 class QNode
 {
 public:
-	float x, y; //coordinates of the node.
+	Coord x, y; //coordinates of the node.
 	T m_data;
-	QNode(float x, float y)
+	QNode(Coord x, Coord y)
 	{
 		this->x = x;
 		this->y = y;
 	}
-	QNode(float x, float y, const T& data)
+	QNode(Coord x, Coord y, const T& data)
 	{
 		this->x = x;
 		this->y = y;
@@ -40,16 +40,59 @@ public:
 		m_data = node->m_data;
 	}
 
-	bool operator==(const QNode<T>* rhs)
+	bool operator==(const QNode* rhs)
 	{
 		return rhs->x == x && rhs->y == y;
 	}
-	bool operator==(const QNode<T>& rhs)
+	bool operator==(const QNode& rhs)
 	{
 		return rhs.x == x && rhs.y == y;
 	}
 };
 
+/* Same idea as QNode, for objects with an extent. LooseQuadTree stores these.
+* x1,y1 is the top left corner of the bounding box, x2,y2 is the bottom right corner.
+*/
+template<class T>
+class QBox
+{
+public:
+	float x1, y1, x2, y2; //bounding box of the object.
+	T m_data;
+	QBox(float x1, float y1, float x2, float y2)
+	{
+		this->x1 = x1;
+		this->y1 = y1;
+		this->x2 = x2;
+		this->y2 = y2;
+	}
+	QBox(float x1, float y1, float x2, float y2, const T& data)
+	{
+		this->x1 = x1;
+		this->y1 = y1;
+		this->x2 = x2;
+		this->y2 = y2;
+		m_data = data;
+	}
+
+	inline float centerX() const { return x1 + (x2 - x1) / 2.0f; }
+	inline float centerY() const { return y1 + (y2 - y1) / 2.0f; }
+
+	/* true if the boxes overlap, touching edges count as overlapping. */
+	inline bool overlaps(float bx1, float by1, float bx2, float by2) const
+	{
+		return x1 <= bx2 && bx1 <= x2 && y1 <= by2 && by1 <= y2;
+	}
+};
+
+/* Shift-Add-XOR for hashing (using TEA) */
+template <typename T>
+inline void hash_combine(std::size_t & seed, const T & v)
+{
+	std::hash<T> hasher;
+	seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
 /* EqualTo pred function for QNode class */
 template<typename T> struct EqualTo : public std::unary_function<std::shared_ptr<T>, bool>
 {
@@ -71,11 +114,3 @@ template<typename T> struct NodeHashFunc : public std::unary_function<std::share
 	}
 
 };
-
-/* Shift-Add-XOR for hashing (using TEA) */
-template <typename T>
-inline void hash_combine(std::size_t & seed, const T & v)
-{
-	std::hash<T> hasher;
-	seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-}
@@ -7,21 +7,64 @@
 * Tree will stop dividing after given depth and will insert extra nodes to max depth instead.
 * By design, I decided not to support duplicates, but you may easily include them by changing insertion and removal.
 * QNode is meant to be a guide to show you how to integrate your object.
+*
+* Memory layout: the tree owns two pools, every quadrant (subtree) is a record in m_quads, linked by indices,
+* and every node lives in a fixed-size bucket block. Blocks are structure-of-arrays: coordinates are kept in m_xs and m_ys
+* so bucket scans stream through two float arrays, the nodes themselves (payloads) sit at the same index in m_points.
+* Parent links are plain indices (non-owning),
+* removed quadrants and blocks go to free lists and get recycled by the next subdivide/insert, clear() just resets the pools.
+* Pointers returned by queries point into the pool, they stay valid until the tree is modified.
+* insert() returns a Handle, handles stay valid until the node is removed and map straight to the node's slot,
+* use them with update(Handle, x, y) to move nodes without searching the tree.
+*
+* Bucket capacity and max depth are either given to the constructor (QuadTree<T>, every tree has its own)
+* or fixed at compile time (QuadTree<T, Capacity, MaxDepth>), which turns the block size into a constant,
+* so slot math becomes shifts and masks for powers of 2 and bucket loops have a known trip count.
 */
 
 #pragma once
 #include <memory>
 #include <iostream>
-#include <unordered_set>
 #include <iterator>
 #include <typeinfo>
 #include <algorithm> //find_if
+#include <vector>
+#include <queue>
+#include <limits>
+#include <thread>
+#include <string>
+#include <atomic>
+#include <cstdio>
+#include <functional>
 #include "QNode.h"
+#include "QuadtreeSimd.hpp"
+#include "ThreadPool.h"
+#include "QuadtreeSnapshot.hpp"
+#include "MappedQuadtree.hpp"
+#include "QuadtreeStats.hpp"
+#include "QuadtreeIndex.hpp"
+#include "QuadtreeRay.hpp"
+#include "QuadtreeWatch.hpp"
 
-template<class T>
-class QuadTree : public enable_shared_from_this<QuadTree<T>>
+template<class T, int Capacity = 0, int MaxDepth = INT32_MAX>	//Capacity 0: both are given to the constructor.
+class QuadTree
 {
 public:
+	typedef int Handle;					//stable id of a node, see insert() and update(Handle, x, y)
+	static const Handle INVALID_HANDLE = -1;
+
+	typedef std::pair<const QNode<T>*, const QNode<T>*> NodePair;	//see selfJoin()
+
+	typedef int WatchId;				//id of a region watch, see watch()
+	typedef std::function<void(const QNode<T>&, QuadWatchEvent)> WatchCallback;
+
+	/* a queued move, see moveAll() */
+	struct Move
+	{
+		Handle handle;
+		float x, y;
+	};
+
 	QuadTree(const QuadTree&) = delete;				//forbid copy constructor
 	QuadTree& operator=(QuadTree const&) = delete;	//forbid copy assignment operator
 	QuadTree() = delete;							//forbid default constructor
@@ -34,34 +77,30 @@ public:
 	//@depth specifies how many times a tree can split, default value will be INT32_MAX
 	explicit QuadTree(float x1, float y1, float x2, float y2, int bucketCapacity, int depth = INT32_MAX)
 	{
-		m_x = x1;
-		m_y = y1;
-		m_width = x2;
-		m_height = y2;
-		m_bucketCapacity = bucketCapacity;
-		m_maxDepth = depth;
-		m_currentBucketSize = 0;
-		m_curDepth = 0;
-		m_isLeaf = true;
-		m_nodes.reserve(bucketCapacity + 1); //for each vector, we need up to bucketcapacity + 1 space (+1 because we'll push the next node onto vector before we subdivde)
-		m_trees.reserve(4); //each subtree.
+		static_assert(Capacity == 0, "bucket capacity and depth of this tree are template parameters, use QuadTree(x1, y1, x2, y2)");
+		init(x1, y1, x2, y2, bucketCapacity, depth);
+	}
+
+	//same as above, for trees whose bucket capacity and depth are template parameters.
+	explicit QuadTree(float x1, float y1, float x2, float y2)
+	{
+		static_assert(Capacity > 0, "bucket capacity of this tree isn't a template parameter, pass it to the constructor");
+		init(x1, y1, x2, y2, Capacity, MaxDepth);
 	}
 
 
 	/* First check if there is a space within the tree, if the quadrant is a leaf node, and there is a space, insert it into it
 	* If the bucket is full, then divide it to quadrants and then insert every element in the current tree to appropriate sbutrees.
-	* allocation is done inside this node
-	* you must have allocated node object the ptr points to before using this funct
+	* @node is copied into the tree's pool, caller keeps the ownership of @node.
+	* returns the handle of the new node, INVALID_HANDLE if @node is nullptr or a node with the same coordinates is already in the tree.
 	*/
-	void insert(QNode<T> *node)
+	Handle insert(QNode<T> *node)
 	{
 		/* Can't insert nullptr */
 		if (node == nullptr) {
-			return;
+			return INVALID_HANDLE;
 		}
-
-		std::shared_ptr<QNode<T>> newNode(make_shared<QNode<T>>(node));
-		insertHelper(shared_from_this(), newNode);
+		return insertHelper(*node);
 	}
 
 
@@ -70,420 +109,2330 @@ public:
 	* @param y:		y-coordinate of the node
 	* @param data:		data the node holds
 	*/
-	void insert(float x, float y, const T& data)
+	Handle insert(float x, float y, const T& data)
+	{
+		return insertHelper(QNode<T>(x, y, data));
+	}
+
+	/* Builds the whole tree in one pass from @count nodes starting at @nodes.
+	* Instead of walking the tree and splitting buckets on every insertion, nodes are partitioned by quadrant recursively
+	* and every subtree is created exactly once. The 4 quadrants of the upper levels are partitioned in parallel,
+	* @threads caps the num of threads used (0 uses every core, 1 builds on the calling thread).
+	* Only an empty tree can be bulk loaded, otherwise the nodes are inserted one by one.
+	* When loading an empty tree, the handle of nodes[i] is i (duplicates don't get one).
+	* Like inserting @nodes in order, the first of several nodes at the same coordinates is kept and the others are dropped.
+	* O(N log4(N))
+	*/
+	void bulkLoad(const QNode<T>* nodes, size_t count, unsigned threads = 0)
 	{
-		std::shared_ptr<QNode<T>> newNode(make_shared<QNode<T>>(x, y, data));
-		insertHelper(shared_from_this(), newNode);
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		if (threads <= 1 || count < BULK_LOAD_PARALLEL_CUTOFF) {
+			bulkLoadHelper(nodes, count, nullptr);
+			return;
+		}
+		ThreadPool pool(threads - 1); //the calling thread works inside wait() too.
+		bulkLoadHelper(nodes, count, &pool);
+	}
+
+	/* same as above, subtrees and bucket copies are split into tasks that run on @pool.
+	* Blocks until every task of @pool is done.
+	*/
+	void bulkLoad(const QNode<T>* nodes, size_t count, ThreadPool& pool)
+	{
+		bulkLoadHelper(nodes, count, &pool);
+	}
 
+	/* same as above, takes every node in @nodes */
+	void bulkLoad(const vector<QNode<T>>& nodes, unsigned threads = 0)
+	{
+		bulkLoad(nodes.data(), nodes.size(), threads);
+	}
+
+	/* same as above, on @pool */
+	void bulkLoad(const vector<QNode<T>>& nodes, ThreadPool& pool)
+	{
+		bulkLoad(nodes.data(), nodes.size(), pool);
 	}
 
 	/*
 	* param @node to update its location.
 	* param @x new x coordinates of @node
 	* param @y new y coordinates of @node
-	* Given @node, moves it to given x,y coordinates. 
-	* WARNING: Haven't finished implemented this yet, it's still buggy use it with caution.
-	* TODO: Calculate complexity.
-	* TODO: this will be the most used function, try to optimize it as much as you can.
+	* Given @node, moves it to given x,y coordinates.
+	* Finds the node first (O(log4(N))), then does the same thing as update(Handle, x, y).
+	* Nothing happens if @node isn't in the tree or another node already sits at x,y.
 	*/
 	inline void update(QNode<T>& node, float x, float y)
 	{
-		/* qTree can only be parent IF there is only 1 node in the tree. */
-		shared_ptr <QuadTree<T>> qTree = findHelper(node);
-		int count = qTree->m_nodes.count(make_shared<QNode<T>>(node)); //returns false!
+		QUADTREE_TIME(UPDATE_OPERATION);
+		int index = findSlot(node.x, node.y);
 		//node doesn't exist in the tree.
-		if (count == 0) {
-			//cout << "couldn't find the node in the tree!" << endl;
+		if (index < 0) {
 			return;
 		}
-		
-		shared_ptr <QNode<T>> nodeptr = make_shared<QNode<T>>(node);
-
-		/* could fit in the current quadrant, no need to move. */
-		if (couldFit(qTree, x, y)) {
-			nodeptr->x = x;
-			nodeptr->y = y;
-			qTree->m_nodes.insert(std::move(nodeptr));
-			qTree->m_nodes.erase(make_shared<QNode<T>>(node));
-			//only if you want to update the node obj as well. 
+		if (updateHelper(m_slotHandle[index], x, y)) {
+			//only if you want to update the node obj as well.
 			node.x = x;
 			node.y = y;
 		}
-		else {
-			shared_ptr <QuadTree<T>> root = shared_from_this();
-			while (qTree != root) {
-				qTree = qTree->m_parent;
-				if (couldFit(qTree, x, y)) {
-					int quadrant = checkQuadrant(qTree, x, y);
-					nodeptr->x = x;
-					nodeptr->y = y;
-					insertHelper(qTree, std::move(nodeptr)); //bug: removes them from the tree (qTree->m_trees[quadrant])
-					remove(node); //need to call remove to get rid of node
-					//node.x = x; 
-					//node.y = y;
+	}
+
+	/* Moves the node @handle points to, to x,y.
+	* If x,y is still inside the node's leaf, node is updated in place: O(K) to check for a duplicate, K = size of the bucket.
+	* Otherwise climbs to the lowest ancestor that contains x,y, and only the subtrees below that ancestor are touched:
+	* the node is removed from its leaf (reducing the subtrees if needed) and pushed down from the ancestor.
+	* returns false if @handle is invalid or another node already sits at x,y.
+	*/
+	bool update(Handle handle, float x, float y)
+	{
+		QUADTREE_TIME(UPDATE_OPERATION);
+		return updateHelper(handle, x, y);
+	}
+
+	/* Starts a new batch of moves, moves queued by an unfinished batch are dropped.
+	* Usage, once per frame: beginBatch(), moveAll(moves), ..., commit().
+	* The tree isn't touched until commit(), queries in between see the positions from before the batch.
+	*/
+	void beginBatch()
+	{
+		m_batch.clear();
+	}
+
+	/* queues @count moves starting at @moves, each one moves the node of move.handle to move.x, move.y */
+	void moveAll(const Move* moves, size_t count)
+	{
+		m_batch.insert(m_batch.end(), moves, moves + count);
+	}
+
+	/* same as above, queues every move in @moves */
+	void moveAll(const vector<Move>& moves)
+	{
+		moveAll(moves.data(), moves.size());
+	}
+
+	/* Applies the moves queued since beginBatch(), returns the num of moves applied.
+	* 1) moves are applied in the order they were queued, without reducing or dividing any quadrant.
+	*    a move is skipped if its handle is invalid or another node sits at x,y when it's applied.
+	* 2) quadrants that lost nodes are reduced and leaves over capacity are divided, each one once per commit.
+	* Same result as calling update() on every move, but a quadrant crossed by many nodes is restructured once instead of once per crossing.
+	* Large batches find the destination leaf of every move up front on @threads (0 uses every core), the tree is only read by then.
+	*/
+	size_t commit(unsigned threads = 0)
+	{
+		QUADTREE_TIME(COMMIT_OPERATION);
+		size_t count = m_batch.size();
+		if (count == 0) {
+			return 0;
+		}
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+
+		size_t chunk = (count + threads - 1) / threads;
+		if (chunk < BATCH_PARALLEL_CUTOFF) {
+			chunk = BATCH_PARALLEL_CUTOFF;
+		}
+		bool classified = chunk < count;
+		if (classified) {
+			m_batchTarget.resize(count);
+			auto classify = [this](size_t first, size_t last) {
+				for (size_t i = first; i < last; ++i) {
+					const Move& move = m_batch[i];
+					if (isValid(move.handle)) {
+						m_batchTarget[i] = targetLeaf(m_blockOwner[m_handleSlot[move.handle] / blockSize()], move.x, move.y);
+					}
 				}
+			};
+			vector<std::thread> workers;
+			for (size_t first = chunk; first < count; first += chunk) {
+				workers.emplace_back(classify, first, std::min(count, first + chunk));
+			}
+			classify(0, chunk);
+			for (std::thread& worker : workers) {
+				worker.join();
+			}
+		}
+
+		//1) leaves don't change until every move is applied, so a leaf found up front is still the leaf x,y belongs to.
+		size_t applied = 0;
+		m_batchSources.clear();
+		m_batchTargets.clear();
+		for (size_t i = 0; i < count; ++i) {
+			const Move& move = m_batch[i];
+			if (!isValid(move.handle)) {
+				continue;
+			}
+			int index = m_handleSlot[move.handle];
+			int leaf = m_blockOwner[index / blockSize()];
+			if (m_xs[index] == move.x && m_ys[index] == move.y) {
+				applied++;
+				continue;
+			}
+			int target = classified ? m_batchTarget[i] : targetLeaf(leaf, move.x, move.y);
+			if (occupied(target, move.x, move.y)) {
+				continue;
+			}
+			applied++;
+			float oldX = m_xs[index], oldY = m_ys[index];
+			if (target == leaf) {
+				reindex(index, move.x, move.y);
+				QNode<T>& stored = m_points[index];
+				stored.x = m_xs[index] = move.x;
+				stored.y = m_ys[index] = move.y;
+				touch(leaf);
+				notifyWatches(leaf, leaf, stored, oldX, oldY, move.x, move.y);
+				continue;
+			}
+			moveNode(index, leaf, target, move.x, move.y);
+			notifyWatches(leaf, target, m_points[m_handleSlot[move.handle]], oldX, oldY, move.x, move.y);
+			m_batchSources.push_back(leaf);
+			if (m_quads[target].size > bucketCapacity() && m_quads[target].depth < maxDepth()) {
+				m_batchTargets.push_back(target);
+			}
+		}
+		m_batch.clear();
+
+		/* 2) quadrants to reduce are picked before any of them is reduced, reducing frees the leaves they're picked from.
+		* they can't be nested (a reduced quadrant is the highest one with few enough nodes)
+		* and leaves over capacity can't be inside them, so each one is restructured on its own.
+		*/
+		if (m_deferMerges) {
+			for (int leaf : m_batchSources) {
+				markMerge(leaf);
+			}
+			m_batchSources.clear();
+		}
+		for (int& leaf : m_batchSources) {
+			leaf = reductionRoot(leaf);
+		}
+		std::sort(m_batchSources.begin(), m_batchSources.end());
+		m_batchSources.erase(std::unique(m_batchSources.begin(), m_batchSources.end()), m_batchSources.end());
+		for (int top : m_batchSources) {
+			if (top >= 0) {
+				reduce(top);
 			}
 		}
+		for (int target : m_batchTargets) {
+			//the same leaf can be listed more than once, it's empty after the first subdivide.
+			if (m_quads[target].firstChild < 0 && needsSplit(target)) {
+				subdivide(target);
+			}
+		}
+		return applied;
 	}
 
-	/* Recursively removes all the elements in the quadtree (and its subtrees) 
-	 * TODO: it's way too slow. try iterative, see if that would help.
+	/* Subtrees are merged back into their parent once they hold @threshold nodes or less (bucketCapacity() by default).
+	* Leaves split when they go over bucketCapacity(), so a lower threshold leaves a gap between the two:
+	* nodes moving back and forth around a boundary no longer split and merge the same quadrant over and over.
+	* @threshold is clamped to [0, bucketCapacity()], raising it merges the subtrees that qualify now (unless merges are deferred).
 	*/
-	void clear()
+	void setMergeThreshold(int threshold)
 	{
-		m_nodes.clear();
-		for (auto& tree : m_trees) {
-			tree->clear(); //m_nodes.clear()? 
+		int previous = m_mergeThreshold;
+		m_mergeThreshold = std::min(std::max(threshold, 0), bucketCapacity());
+		if (m_mergeThreshold > previous) {
+			//any subtree may qualify now, let compact() look at all of them.
+			std::fill(m_mergePending.begin(), m_mergePending.end(), uint8_t(1));
+			if (!m_deferMerges) {
+				compact();
+			}
 		}
-		m_trees.clear();
-		m_currentBucketSize = 0;
-		m_curDepth = 0;
 	}
 
-	/* TODO: Implement this
-	* Given node returns all the nodes that might collide with @node (currently that means return all the nodes in the same quadrant,
-	* but for AABBs, this will mean every node that's in AABB
+	/* With @deferred, removals and moves never merge subtrees, compact() does it.
+	* Useful when nodes come and go all the time: call compact() once per frame (or when the tree is idle)
+	* and every quadrant is restructured at most once in between. Turning it off calls compact().
 	*/
-	vector<shared_ptr<QNode<T>>> getPossibleCollisions(const QNode<T>& node)
+	void deferMerges(bool deferred)
 	{
-		return nullptr;
+		m_deferMerges = deferred;
+		if (!deferred) {
+			compact();
+		}
 	}
 
-	/* given node find if it's in the quadtree, true if it is, false otherwise
-	* O(log4(N)) to find the tree
-	* O(1) time to find the node.
+	/* Merges every subtree that holds getMergeThreshold() nodes or less, returns the num of subtrees merged.
+	* Only the paths to quadrants that lost nodes since the last compact() are visited: O(M log4(N) + K)
+	* M = num of such leaves, K = num of nodes moved. Nothing to do unless merges are deferred.
 	*/
-	bool find(const QNode<T>& node)
+	size_t compact()
 	{
-		shared_ptr <QuadTree<T>> qTree = findHelper(node);
-		/* Find the node in the unsorted_set, takes O(1) */
-		int count = qTree->m_nodes.count(make_shared<QNode<T>>(node));
-		return count != 0;
+		QUADTREE_TIME(COMPACT_OPERATION);
+		size_t merged = 0;
+		if (m_mergePending[0]) {
+			compactHelper(0, merged);
+		}
+		return merged;
 	}
 
-	/*
-	Find the node and remove it, then call removeSubtree which will find and remove all the redundant subtrees after removing the node.
-	* O(log4(N)) to find the tree,
-	* O(1) to remove the node,
-	* O(K + log4(N)) to reduce the tree (if the reduction needed, O(!) otherwise)  K = num of nodes you have to move while reducing trees.
-	* You can treat overall complexity as O(log4(N)) K should never be larger than m_maxBucketSize
+	/* Removes all the elements in the quadtree (and its subtrees)
+	* O(1), both pools are reset and their storage is kept for the next insertions (O(K) to report the K watched nodes, see watch()).
+	* Payloads of the removed nodes are destroyed when their slots are reused, or when the tree is destroyed.
 	*/
-	void remove(const QNode<T>& node)
+	void clear()
 	{
-		shared_ptr <QuadTree<T>>  qTree = findHelper(node);
-		int removed = qTree->m_nodes.erase(make_shared<QNode<T>>(node));
-		if (removed != 0) {
-			qTree->m_currentBucketSize--; //update the bucketsize of the quadrant MIGHT WANNA MOVE THIS TO removeSubtree() instead.
-			removeSubtree(qTree);
+		if (m_watches.size() > 0) {
+			forEachWatch([this](int id) {
+				forEachWatched(0, id, [this, id](const QNode<T>& node) { m_watches.callback(id)(node, WATCH_EXIT); });
+			});
+			m_watches.detachAll();
+			forEachWatch([this](int id) { m_watches.attach(id, 0); });
 		}
+		const Quadrant& root = m_quads[0];
+		m_quads[0] = makeQuadrant(-1, root.x1, root.y1, root.x2, root.y2, 0);
+		m_dirty[0] = 1;
+		m_mergePending[0] = 0;
+		m_quadTop = 1;
+		m_freeQuads = -1;
+		m_blockTop = 0;
+		m_freeBlocks = -1;
+		m_handleSlot.clear();
+		m_freeHandles.clear();
+		m_pointIndex.clear();
 	}
 
-	/* Getters */
-	inline float getX() const { return m_x; }
-	inline float getY() const { return m_y; }
-	inline float getWidth() const { return m_width; }
-	inline float getHeight() const { return m_height; }
-	inline int getDepth() const { return m_curDepth; }
-
-
-	/* Keep track of the parent ptr to decrease amount of calc done to reinsert a node. */
-	QuadTree(const shared_ptr<QuadTree<T>>& parent, float x1, float y1, float x2, float y2)
+	/* Same as clear(), but payloads of the removed nodes are destroyed right away, split into tasks on @pool,
+	* instead of when their slots are reused. Use it to release what large payloads own without giving up the tree.
+	* Blocks until every task of @pool is done.
+	*/
+	void clear(ThreadPool& pool)
 	{
-		m_parent = parent;
-		m_x = x1;
-		m_y = y1;
-		m_width = x2;
-		m_height = y2;
-		m_currentBucketSize = 0;
-		m_isLeaf = true;
-		m_nodes.reserve(m_bucketCapacity + 1);
+		size_t slots = size_t(m_blockTop) * blockSize();
+		parallelFor(&pool, slots, TRAVERSAL_PARALLEL_CUTOFF, [this](size_t first, size_t last) {
+			for (size_t i = first; i < last; ++i) {
+				m_points[i] = QNode<T>(0, 0);
+			}
+		});
+		clear();
 	}
 
+	/* Publishes the current state of the tree as an immutable snapshot, readers pick it up with snapshot().
+	* Only quadrants modified since the last publish() are copied (along with their ancestors),
+	* every other subtree is shared with the previous snapshot, so publishing after a few moves costs O(M log4(N) + K)
+	* M = num of modified leaves, K = num of nodes in them. The first publish() copies the whole tree.
+	* Must be called from the thread that modifies the tree.
+	*/
+	std::shared_ptr<const QuadTreeSnapshot<T>> publish()
+	{
+		QUADTREE_TIME(PUBLISH_OPERATION);
+		std::shared_ptr<const QuadTreeSnapshot<T>> previous = snapshot();
+		std::shared_ptr<const SnapshotNode> root = publishHelper(0, previous ? &previous->m_root : nullptr);
+		std::shared_ptr<const QuadTreeSnapshot<T>> published(new QuadTreeSnapshot<T>(std::move(root), previous ? previous->version() + 1 : 0));
+		std::atomic_store(&m_published, published);
+		return published;
+	}
 
-private:
+	/* returns the last snapshot published, nullptr if publish() was never called.
+	* Safe to call from any thread while the tree is being modified, the snapshot stays valid as long as it's held.
+	*/
+	std::shared_ptr<const QuadTreeSnapshot<T>> snapshot() const
+	{
+		return std::atomic_load(&m_published);
+	}
 
-	/* removeSubTree should always be called on parent, that way we can always assume subquadtrant exist.
-	* O(log4(N)) to reduce the tree.
-	* TODO: Explain how this work in detail.
+	/* Writes an image of the tree to @path, see MappedQuadtree.hpp for the layout. returns false if the file can't be written.
+	* Quadrants are written breadth first, nodes leaf by leaf, handles aren't saved.
+	* QNode<T> must be trivially copyable, nodes are written as raw bytes.
 	*/
-	void removeSubtree(shared_ptr <QuadTree<T>> tree) //pass by copy because we'll be manipulating @tree
+	bool save(const std::string& path) const
 	{
-		tree = tree->m_parent; // go to its parent
-		tree->m_currentBucketSize--; //update its first parent.
+		static_assert(std::is_trivially_copyable<QNode<T>>::value, "only trees of trivially copyable nodes can be saved");
+		vector<QuadTreeImage::Quad> quads;
+		vector<int> order(1, 0);	//quadrant of each record.
+		uint32_t points = 0;
+		for (size_t i = 0; i < order.size(); ++i) {
+			const Quadrant& quad = m_quads[order[i]];
+			QuadTreeImage::Quad record = { quad.x1, quad.y1, quad.x2, quad.y2, -1, quad.currentBucketSize, 0, 0 };
+			if (quad.firstChild >= 0) {
+				record.firstChild = int32_t(order.size());
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					order.push_back(quad.firstChild + quadrant);
+				}
+			}
+			else {
+				record.first = points;
+				record.size = uint32_t(quad.size);
+				points += uint32_t(quad.size);
+			}
+			quads.push_back(record);
+		}
 
-		shared_ptr <QuadTree<T>> root = shared_from_this();
-		shared_ptr <QuadTree<T>> prev = tree;
+		QuadTreeImage::Header header;
+		std::memset(&header, 0, sizeof(header));
+		QuadTreeImage::setMagic(header.magic);
+		header.version = QuadTreeImage::VERSION;
+		header.byteOrder = QuadTreeImage::BYTE_ORDER_MARK;
+		header.nodeSize = sizeof(QNode<T>);
+		header.quadCount = uint32_t(quads.size());
+		header.pointCount = points;
+		header.quadOffset = QuadTreeImage::align(sizeof(header));
+		header.xsOffset = QuadTreeImage::align(header.quadOffset + quads.size() * sizeof(QuadTreeImage::Quad));
+		header.ysOffset = QuadTreeImage::align(header.xsOffset + points * sizeof(float));
+		header.pointsOffset = QuadTreeImage::align(header.ysOffset + points * sizeof(float));
+		header.fileSize = header.pointsOffset + uint64_t(points) * sizeof(QNode<T>);
+		header.bucketCapacity = bucketCapacity();
+		header.maxDepth = maxDepth();
 
-		//check if you need to perform reduction at all.
-		if (tree->m_currentBucketSize > m_bucketCapacity) {
-			//still need to update bucket sizes
-			while (tree != root) {
-				tree->m_parent->m_currentBucketSize--;
-				tree = tree->m_parent;
+		std::FILE* file = std::fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			return false;
+		}
+		uint64_t offset = 0;
+		bool ok = true;
+		auto write = [&](const void* data, size_t bytes, uint64_t at) {
+			static const char zeros[QuadTreeImage::ALIGNMENT] = {};
+			ok = ok && std::fwrite(zeros, 1, size_t(at - offset), file) == size_t(at - offset);
+			ok = ok && (bytes == 0 || std::fwrite(data, 1, bytes, file) == bytes);
+			offset = at + bytes;
+		};
+		write(&header, sizeof(header), 0);
+		write(quads.data(), quads.size() * sizeof(QuadTreeImage::Quad), header.quadOffset);
+		const vector<float>* arrays[2] = { &m_xs, &m_ys };
+		uint64_t starts[2] = { header.xsOffset, header.ysOffset };
+		for (int a = 0; a < 2; ++a) {
+			uint64_t at = starts[a];
+			for (int q : order) {
+				forEachBlock(q, [&](int base, int count) {
+					write(&(*arrays[a])[base], count * sizeof(float), at);
+					at += count * sizeof(float);
+				});
 			}
-			return;
 		}
+		uint64_t at = header.pointsOffset;
+		for (int q : order) {
+			forEachBlock(q, [&](int base, int count) {
+				write(&m_points[base], count * sizeof(QNode<T>), at);
+				at += count * sizeof(QNode<T>);
+			});
+		}
+		//empty trees end with the padding of the empty arrays.
+		write(nullptr, 0, header.fileSize);
+		return std::fclose(file) == 0 && ok;
+	}
 
+	/* Maps the image @path written by save() and serves queries straight from it, nothing is read or allocated up front.
+	* returns nullptr if the file can't be mapped or isn't an image of a tree of QNode<T>.
+	*/
+	static std::unique_ptr<const MappedQuadTree<T>> mapReadOnly(const std::string& path)
+	{
+		return std::unique_ptr<const MappedQuadTree<T>>(MappedQuadTree<T>::map(path));
+	}
 
+	/* Given node returns all the nodes that might collide with @node (currently that means all the nodes in the same quadrant,
+	* but for AABBs, this will mean every node that's in AABB)
+	* Results are appended to @out as non-owning pointers, reuse the same vector between calls to avoid allocations.
+	* O(log4(N)) to find the quadrant, O(K) to copy its nodes.
+	*/
+	void getPossibleCollisions(const QNode<T>& node, vector<const QNode<T>*>& out) const
+	{
+		forEachInBucket(leafHelper(node.x, node.y), [&out](const QNode<T>& n) { out.push_back(&n); });
+	}
 
-		/* MOVE all the nodes in each quadrant to tempSet, which will be used to move the nodes of reduced tree to new one. */
-		unordered_set<shared_ptr<QNode<T>>, NodeHashFunc<QNode<T>>, EqualTo<QNode<T>>> tempSet;
-		/* Move all the nodes of each quadrant into tempSet */
-		std::move(tree->m_trees[NW_QUADRANT]->m_nodes.begin(), tree->m_trees[NW_QUADRANT]->m_nodes.end(), std::inserter(tempSet, tempSet.begin()));
-		std::move(tree->m_trees[SW_QUADRANT]->m_nodes.begin(), tree->m_trees[SW_QUADRANT]->m_nodes.end(), std::inserter(tempSet, tempSet.begin()));
-		std::move(tree->m_trees[NE_QUADRANT]->m_nodes.begin(), tree->m_trees[NE_QUADRANT]->m_nodes.end(), std::inserter(tempSet, tempSet.begin()));
-		std::move(tree->m_trees[SE_QUADRANT]->m_nodes.begin(), tree->m_trees[SE_QUADRANT]->m_nodes.end(), std::inserter(tempSet, tempSet.begin()));
+	/* Calls @visitor(const QNode<T>&) for every node inside the rectangle x1,y1 - x2,y2 (inclusive).
+	* Only subtrees whose boundaries overlap the rectangle are visited, nothing is allocated.
+	* O(log4(N) + K) K = num of nodes in the overlapping quadrants.
+	*/
+	template<class Visitor>
+	void query(float x1, float y1, float x2, float y2, Visitor&& visitor) const
+	{
+		QUADTREE_TIME(QUERY_OPERATION);
+		queryHelper(0, x1, y1, x2, y2, visitor);
+	}
 
+	/* same as above, but appends the nodes found to @out instead. */
+	void query(float x1, float y1, float x2, float y2, vector<const QNode<T>*>& out) const
+	{
+		query(x1, y1, x2, y2, [&out](const QNode<T>& node) { out.push_back(&node); });
+	}
 
-		//while tree is not root, we can traverse to parent.
-		while (tree != root) {
-			tree->m_parent->m_currentBucketSize--; //decrease one, then check. (since we removed a node, parents trees bucketsize haven't updated yet.
-			if (tree->m_currentBucketSize <= m_bucketCapacity) { //if bucket size is less than capacity, can reduce that tree, go to its parent.
-				prev = tree;
-				tree = tree->m_parent;
-			}
-			else {
-				//we're on a tree that can't be reduced, move all the nodes to the correct quadrant of this tree and remove all the subtrees.
-				int quadrant = checkQuadrant(tree, prev);
-				prev->m_trees.clear(); //clear all the data of the quadrant.
-				//move all the nodes from tempset to the new, reduced quadrant
-				std::move(tempSet.begin(), tempSet.end(), std::inserter(tree->m_trees[quadrant]->m_nodes, tree->m_trees[quadrant]->m_nodes.begin()));
-
-				//update currentBucketSize of rest of the parent trees including root. 
-				tree = tree->m_parent;
-				while (tree != root) {
-					tree->m_parent->m_currentBucketSize--;
-					tree = tree->m_parent;
-				}
-			}
-		}
+	/* Calls @visitor(const QNode<T>&) for every node within @radius of cx,cy (inclusive).
+	* Subtrees are pruned by the distance between cx,cy and their boundaries.
+	*/
+	template<class Visitor>
+	void queryCircle(float cx, float cy, float radius, Visitor&& visitor) const
+	{
+		QUADTREE_TIME(QUERY_CIRCLE_OPERATION);
+		queryCircleHelper(0, cx, cy, radius * radius, visitor);
 	}
 
-	/* Given quadtree and x,y check if x,y is within the boundaries of @tree */
-	bool couldFit(const shared_ptr<QuadTree<T>>& tree, float x, float y)
+	/* same as above, but appends the nodes found to @out instead. */
+	void queryCircle(float cx, float cy, float radius, vector<const QNode<T>*>& out) const
 	{
-		return (tree->m_x <= x && x <= tree->m_width) && (tree->m_y <= y && y <= tree->m_height);
+		queryCircle(cx, cy, radius, [&out](const QNode<T>& node) { out.push_back(&node); });
 	}
 
-	/* Helper function, used by find() and remove(), given node finds the quadrant, the node *would* be in if it exist
-	* it then checks the quadrant, if the node exist, returns the quadtrant, if it doesn't returns the last leaf node with node child.
-	* takes O(log4(N)) time to find the quadtree that contains the node.
+	/* Returns the first node hit by the ray from ox,oy towards dx,dy within @maxDist, nullptr if there is none.
+	* Nodes are discs of @radius, @distance gets the distance along the ray to the edge of the disc hit.
+	* Subtrees are visited front to back (subdivide()'s NW, NE, SW, SE order flipped by the signs of the direction)
+	* and the ones the ray enters past the closest hit so far are skipped, so the search ends soon after the first hit.
 	*/
-	shared_ptr <QuadTree<T>> findHelper(const QNode<T>& node)
+	const QNode<T>* raycast(float ox, float oy, float dx, float dy, float maxDist, float radius = 0.0f, float* distance = nullptr) const
 	{
-		shared_ptr <QuadTree<T>> currentHead = shared_from_this();
-		/* if m_trees size is > 0, then child exist, */
-		while (currentHead->m_trees.size() != 0) {
-			int quadrant = checkQuadrant(currentHead, node);
-			switch (quadrant) {
-			case NW_QUADRANT:
-				currentHead = currentHead->m_trees[NW_QUADRANT];
-				break;
-			case NE_QUADRANT:
-				currentHead = currentHead->m_trees[NE_QUADRANT];
-				break;
-			case SW_QUADRANT:
-				currentHead = currentHead->m_trees[SW_QUADRANT];
-				break;
-			case SE_QUADRANT:
-				currentHead = currentHead->m_trees[SE_QUADRANT];
-				break;
-			default: //throw a runtime error instead
-				std::cout << "ERROR: UNDEFINED QUADRANT! THIS SHOULD NEVER HAVE HAPPENED!" << std::endl;
-				exit(-1);
-				break;
+		QUADTREE_TIME(RAYCAST_OPERATION);
+		QuadRay ray;
+		if (!QuadRay::make(ox, oy, dx, dy, radius, ray) || !(maxDist >= 0.0f)) {
+			return nullptr;
+		}
+		const QNode<T>* best = nullptr;
+		float maxT = maxDist;
+		castHelper(0, ray, maxT, [&best](const QNode<T>& node, float t, float& limit) {
+			if (best == nullptr || t < limit) {
+				best = &node;
+				limit = t;
 			}
+		});
+		if (best != nullptr && distance != nullptr) {
+			*distance = maxT;
 		}
-		return currentHead;
+		return best;
+	}
+
+	/* Calls @visitor(const QNode<T>&, float distance) for every node within @radius of the segment x1,y1 - x2,y2,
+	* distance is measured along the segment from x1,y1 to the edge of the node's disc.
+	* Leaves are visited front to back, the nodes of a leaf in no particular order.
+	*/
+	template<class Visitor>
+	void segmentQuery(float x1, float y1, float x2, float y2, float radius, Visitor&& visitor) const
+	{
+		QUADTREE_TIME(RAYCAST_OPERATION);
+		QuadRay ray;
+		float maxT = std::sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+		if (!QuadRay::make(x1, y1, x2 - x1, y2 - y1, radius, ray)) {
+			//the segment is a point, any direction finds the nodes around it at 0.
+			QuadRay::make(x1, y1, 1.0f, 0.0f, radius, ray);
+			maxT = 0.0f;
+		}
+		castHelper(0, ray, maxT, [&visitor](const QNode<T>& node, float t, float&) { visitor(node, t); });
 	}
 
-	/* private insert funct, should only be used internally. */
-	inline void insert(const shared_ptr<QNode<T>>& node)
+	/* same as above, but appends the nodes found to @out sorted from x1,y1 to x2,y2. */
+	void segmentQuery(float x1, float y1, float x2, float y2, float radius, vector<const QNode<T>*>& out) const
 	{
-		insertHelper(shared_from_this(), node);
+		vector<std::pair<float, const QNode<T>*>> hits;
+		segmentQuery(x1, y1, x2, y2, radius, [&hits](const QNode<T>& node, float t) { hits.emplace_back(t, &node); });
+		std::stable_sort(hits.begin(), hits.end(), [](const std::pair<float, const QNode<T>*>& a, const std::pair<float, const QNode<T>*>& b) {
+			return a.first < b.first;
+		});
+		for (const std::pair<float, const QNode<T>*>& hit : hits) {
+			out.push_back(hit.second);
+		}
 	}
 
+	/* Calls @fn(const QNode<T>&) for every node in the tree, leaf by leaf. */
+	template<class Fn>
+	void forEach(Fn&& fn) const
+	{
+		forEachHelper(0, fn);
+	}
 
+	/* Same as above, subtrees with many nodes are split into tasks that run on @pool, smaller ones are visited by a single task.
+	* @fn is called from several threads at once, use pool.threadIndex() to pick per-thread state.
+	* Blocks until every task of @pool is done, the tree must not be modified in the meantime.
+	*/
+	template<class Fn>
+	void forEach(ThreadPool& pool, Fn&& fn) const
+	{
+		pool.submit([this, &pool, &fn] { parallelForEach(0, pool, fn); });
+		pool.wait();
+	}
 
+	/* Appends the @k closest nodes to x,y onto @out, sorted from closest to farthest.
+	* Subtrees are visited best-first by the distance between x,y and their boundaries,
+	* search stops as soon as the k-th best distance is closer than every remaining subtree.
+	*/
+	void nearest(float x, float y, size_t k, vector<const QNode<T>*>& out) const
+	{
+		nearestHelper(x, y, k, std::numeric_limits<float>::infinity(), out);
+	}
 
+	/* returns the closest node to x,y that's within @radius (inclusive), nullptr if there is none. */
+	const QNode<T>* nearestWithin(float x, float y, float radius) const
+	{
+		vector<const QNode<T>*> out;
+		out.reserve(1);
+		nearestHelper(x, y, 1, radius * radius, out);
+		return out.empty() ? nullptr : out.front();
+	}
 
-	/* Helper func used by all the insert functions.
-	* if the node we're leaf
-	*	1) if current size is less than the max, insert the element onto that node.
-	*	2) if current depth is less than the max, subdivide the tree, insert them onto current node, and rearrange the node.
-	*	3) otherwise we reached max depth and max capacity, we can't divide any more but we can still override max capacity and insert them onto the current node
-	* else
-	*   we're at max capacity, insert them onto the first node you find (root) and call rearrange to find the correct spot.
-	* When it's called by insert functions, tree will always be shared_from_this() (shared ptr to "this")
+	/* same as above but appends up to @k closest nodes within @radius onto @out, sorted from closest to farthest. */
+	void nearestWithin(float x, float y, float radius, size_t k, vector<const QNode<T>*>& out) const
+	{
+		nearestHelper(x, y, k, radius * radius, out);
+	}
+
+	/* Calls @visitor(const QNode<T>&, const QNode<T>&) once for every pair of nodes within @distance of each other (inclusive).
+	* Walks the subtrees instead of running one range query per node: every leaf is compared with itself,
+	* and every 2 subtrees closer than @distance are compared once, down to their leaves.
+	* O(N + P) for evenly spread nodes, P = num of pairs.
 	*/
-	inline void insertHelper(shared_ptr<QuadTree<T>>& tree, const shared_ptr<QNode<T>>& node)
+	template<class Visitor>
+	void selfJoin(float distance, Visitor&& visitor) const
 	{
-		if (m_isLeaf) {
-			if (m_currentBucketSize < m_bucketCapacity) {
-				m_nodes.emplace(std::move(node)); 
-				m_currentBucketSize++;
-			}
-			else if (m_curDepth < m_maxDepth) {
-				subdivide();
-				m_nodes.emplace(std::move(node));
-				m_currentBucketSize++;
-				reArrangeNodes(tree);
-			}
-			else {
-				m_nodes.emplace(std::move(node));
-				m_currentBucketSize++;
-			}
+		selfJoinHelper(0, distance * distance, visitor);
+	}
+
+	/* same as above, but appends the pairs found to @out instead. */
+	void selfJoin(float distance, vector<NodePair>& out) const
+	{
+		selfJoin(distance, [&out](const QNode<T>& a, const QNode<T>& b) { out.push_back(NodePair(&a, &b)); });
+	}
+
+	/* Same as above, large subtrees and pairs of subtrees are split into tasks that run on @pool.
+	* Every thread appends the pairs it finds to its own buffer: @buffers is resized to pool.size() + 1,
+	* buffers[i] gets the pairs found by worker i, the last one gets the pairs found by the calling thread.
+	* Blocks until every task of @pool is done, the tree must not be modified in the meantime.
+	*/
+	void selfJoin(float distance, ThreadPool& pool, vector<vector<NodePair>>& buffers) const
+	{
+		buffers.resize(pool.size() + 1);
+		for (vector<NodePair>& buffer : buffers) {
+			buffer.clear();
 		}
-		else { /* This will only triggered when depth is more than max,
-			   remove this block if you wish to stop adding elements to tree after depth >= maxDepth and bucketSize >= maxBucketSize */
-			m_nodes.emplace(std::move(node));
-			m_currentBucketSize++;
-			reArrangeNodes(tree); //must rearrange them, since we'd be adding them to root.
+		float distSq = distance * distance;
+		pool.submit([this, distSq, &pool, &buffers] { parallelSelfJoin(0, distSq, pool, buffers); });
+		pool.wait();
+	}
+
+	/* Spatial join with another tree: calls @visitor(const QNode<T>&, const QNode<U>&) once for every node of this tree
+	* and node of @other within @distance of each other (inclusive).
+	* Both trees are descended together, the larger quadrant of a pair is divided first and pairs farther than @distance are skipped,
+	* so the trees can have different boundaries, bucket capacities and depths.
+	*/
+	template<class U, int C, int D, class Visitor>
+	void join(const QuadTree<U, C, D>& other, float distance, Visitor&& visitor) const
+	{
+		crossJoinHelper(0, other, 0, distance * distance, visitor);
+	}
+
+	/* same as above, but appends the pairs found to @out instead. */
+	template<class U, int C, int D>
+	void join(const QuadTree<U, C, D>& other, float distance, vector<std::pair<const QNode<T>*, const QNode<U>*>>& out) const
+	{
+		join(other, distance, [&out](const QNode<T>& a, const QNode<U>& b) { out.push_back(std::make_pair(&a, &b)); });
+	}
+
+	/* Same as above, pairs of quadrants with many nodes (starting from the pairs of top level quadrants) are split into tasks on @pool.
+	* Per-thread buffers work like selfJoin(distance, pool, buffers). Neither tree may be modified until it returns.
+	*/
+	template<class U, int C, int D>
+	void join(const QuadTree<U, C, D>& other, float distance, ThreadPool& pool, vector<vector<std::pair<const QNode<T>*, const QNode<U>*>>>& buffers) const
+	{
+		buffers.resize(pool.size() + 1);
+		for (auto& buffer : buffers) {
+			buffer.clear();
 		}
+		float distSq = distance * distance;
+		pool.submit([this, &other, distSq, &pool, &buffers] { parallelCrossJoin(0, other, 0, distSq, pool, buffers); });
+		pool.wait();
 	}
 
-	/* divides quadtree to 4 quadtrants
-	* updates current depth
-	* updates m_isLeaf for the current tree.
+	/* given node find if it's in the quadtree, true if it is, false otherwise
+	* O(log4(N)) to find the quadrant
+	* O(K) to scan its bucket, K is at most bucketCapacity() unless the quadrant can't be split (see needsSplit()).
 	*/
-	void subdivide()
+	bool find(const QNode<T>& node) const
 	{
-		float newXRegion = m_width / 2.0f;
-		float newYRegion = m_height / 2.0f;
+		QUADTREE_TIME(FIND_OPERATION);
+		return findSlot(node.x, node.y) >= 0;
+	}
 
-		//NW, NE, SW, SE
-		m_trees.emplace_back(make_shared<QuadTree<T>>(shared_from_this(), m_x, m_y, newXRegion, newYRegion));
-		m_trees.emplace_back(make_shared<QuadTree<T>>(shared_from_this(), m_x + newXRegion, m_y, m_width, newYRegion));
-		m_trees.emplace_back(make_shared<QuadTree<T>>(shared_from_this(), m_x, m_y + newYRegion, newXRegion, m_height));
-		m_trees.emplace_back(make_shared<QuadTree<T>>(shared_from_this(), m_x + newXRegion, m_y + newYRegion, m_width, m_height));
+	/*
+	Find the node and remove it, then call removeSubtree which will find and remove all the redundant subtrees after removing the node.
+	* O(log4(N)) to find the tree,
+	* O(1) to remove the node (last node of the bucket takes its slot),
+	* O(K + log4(N)) to reduce the tree (if the reduction needed, O(1) otherwise)  K = num of nodes you have to move while reducing trees.
+	* You can treat overall complexity as O(log4(N)) K should never be larger than m_maxBucketSize
+	*/
+	void remove(const QNode<T>& node)
+	{
+		QUADTREE_TIME(REMOVE_OPERATION);
+		int index = findSlot(node.x, node.y);
+		if (index >= 0) {
+			removeHelper(m_blockOwner[index / blockSize()], index);
+		}
+	}
+
+	/* removes the node @handle points to, O(1) to find the node, then same as above. */
+	void remove(Handle handle)
+	{
+		QUADTREE_TIME(REMOVE_OPERATION);
+		if (isValid(handle)) {
+			int index = m_handleSlot[handle];
+			removeHelper(m_blockOwner[index / blockSize()], index);
+		}
+	}
 
+	/* true if @handle points to a node that's still in the tree. */
+	inline bool isValid(Handle handle) const
+	{
+		return handle >= 0 && size_t(handle) < m_handleSlot.size() && m_handleSlot[handle] >= 0;
+	}
 
-		//set depth of the current tree
-		m_trees[NW_QUADRANT]->setDepth(m_curDepth + 1);
-		m_trees[NE_QUADRANT]->setDepth(m_curDepth + 1);
-		m_trees[SW_QUADRANT]->setDepth(m_curDepth + 1);
-		m_trees[SE_QUADRANT]->setDepth(m_curDepth + 1);
+	/* returns the node @handle points to, nullptr if the handle is invalid. */
+	const QNode<T>* getNode(Handle handle) const
+	{
+		return isValid(handle) ? &m_points[m_handleSlot[handle]] : nullptr;
+	}
 
-		m_isLeaf = false; //tree is divided to quadrants, it's no longer a leaf node.
+	/* Registers a standing watch on the rectangle x1,y1 - x2,y2 (inclusive, like query()) and returns its id, see QuadtreeWatch.hpp.
+	* @callback(const QNode<T>&, QuadWatchEvent) gets WATCH_ENTER for every node already inside right away, then WATCH_ENTER or WATCH_EXIT
+	* every time insert, remove, update, commit, bulkLoad or clear takes a node across the rectangle. Moves within it (or outside of it)
+	* aren't reported, nodes that moved are reported at their new position, removed nodes right before they're removed.
+	* Only the watches attached to the path of a node are tested, so the cost follows the nodes crossing a boundary instead of
+	* the num of watches. Callbacks must not modify the tree or its watches.
+	* O(log4(N)) to attach the watch, plus the nodes already inside.
+	*/
+	WatchId watch(float x1, float y1, float x2, float y2, WatchCallback callback)
+	{
+		WatchId id = m_watches.add(x1, y1, x2, y2, std::move(callback));
+		m_watches.resizeQuads(m_quads.size());
+		placeWatch(id, 0);
+		forEachWatched(0, id, [this, id](const QNode<T>& node) { m_watches.callback(id)(node, WATCH_ENTER); });
+		return id;
+	}
 
+	/* Removes the watch @id, nothing is reported. returns false if @id isn't a watch. */
+	bool unwatch(WatchId id)
+	{
+		return m_watches.erase(id);
 	}
 
-	/* private setter, used by subdivision */
-	inline void setDepth(int depth) {
-		m_curDepth = depth;
+	inline size_t watchCount() const { return m_watches.size(); }
+
+	/* Turns the point index on or off (off by default), see QuadtreeIndex.hpp.
+	* With the index, find(), remove(node), update(node, x, y) and the duplicate checks of insert() and moves hash the coordinates
+	* straight to the node's handle, O(1), instead of descending from the root and scanning the bucket.
+	* It costs 12 to 24 bytes per node and one more probe per insert, remove and move.
+	* Turning it on builds it from the nodes already in the tree, O(N), turning it off frees it.
+	*/
+	void usePointIndex(bool enabled)
+	{
+		m_indexed = enabled;
+		if (enabled) {
+			rebuildPointIndex();
+		}
+		else {
+			m_pointIndex.release();
+		}
 	}
 
+	inline bool hasPointIndex() const { return m_indexed; }
+
+	/* Getters */
+	inline float getX() const { return m_quads[0].x1; }
+	inline float getY() const { return m_quads[0].y1; }
+	inline float getWidth() const { return m_quads[0].x2; }
+	inline float getHeight() const { return m_quads[0].y2; }
+	inline int getDepth() const { return m_quads[0].depth; }
+	inline int getBucketCapacity() const { return bucketCapacity(); }
+	inline int getMaxDepth() const { return maxDepth(); }
+	inline int getMergeThreshold() const { return m_mergeThreshold; }
+	inline bool mergesDeferred() const { return m_deferMerges; }
+	inline int size() const { return m_quads[0].currentBucketSize; }
+
+	/* bytes reserved by the pools, divide by size() to get the memory cost per node. */
+	size_t bytesUsed() const
+	{
+		return sizeof(*this) + m_quads.capacity() * sizeof(Quadrant) + m_points.capacity() * sizeof(QNode<T>)
+			+ (m_xs.capacity() + m_ys.capacity()) * sizeof(float) + (m_blockNext.capacity() + m_blockOwner.capacity()) * sizeof(int)
+			+ (m_slotHandle.capacity() + m_handleSlot.capacity() + m_freeHandles.capacity()) * sizeof(Handle)
+			+ m_batch.capacity() * sizeof(Move) + (m_batchTarget.capacity() + m_batchSources.capacity() + m_batchTargets.capacity()) * sizeof(int)
+			+ (m_dirty.capacity() + m_mergePending.capacity()) * sizeof(uint8_t) + m_pointIndex.bytesUsed() + m_watches.bytesUsed();
+	}
 
-	/* Pushes nodes currently located on @tree to the appropriate subtrees. (treats @tree as the root)
-	* called after subtrees are generated.
-	* NOTE: this funct uses move semantics to prevent unnecessary copies and increase performance.
-	* O(1) time to erase
-	* O(1) time to move
-	* O(log4(N)) time to recursively insert
+	/* Walks every quadrant and returns the shape of the tree: leaves per depth, bucket occupancy, overflow at max depth...
+	* O(Q) Q = num of quadrants, only the histograms are allocated.
 	*/
-	inline void reArrangeNodes(shared_ptr <QuadTree<T>>& tree)
+	QuadTreeStats stats() const
 	{
-		for (auto it = tree->m_nodes.begin(); it != tree->m_nodes.end();) { //++it) {
-			int quadrant = checkQuadrant((**it));
-			//move the node into appropriate quadrant
-			switch (quadrant) {
-				case NW_QUADRANT:
-					tree->m_trees[NW_QUADRANT]->insert(std::move(*it));
-					tree->m_nodes.erase(it++);
-					break;
-				case NE_QUADRANT:
-					tree->m_trees[NE_QUADRANT]->insert(std::move(*it));
-					tree->m_nodes.erase(it++);
-					break;
-				case SW_QUADRANT:
-					tree->m_trees[SW_QUADRANT]->insert(std::move(*it));
-					tree->m_nodes.erase(it++);
-					break;
-				case SE_QUADRANT:
-					tree->m_trees[SE_QUADRANT]->insert(std::move(*it));
-					tree->m_nodes.erase(it++);
-					break;
-				default: //throw a runtime error instead
-					std::cout << "ERROR: UNDEFINED QUADRANT! THIS SHOULD NEVER HAVE HAPPENED!" << std::endl;
-					exit(-1);
-					break;
+		QuadTreeStats stats;
+		stats.nodes = size_t(size());
+		stats.quadrants = 0;
+		stats.leaves = 0;
+		stats.emptyLeaves = 0;
+		stats.depth = 0;
+		stats.occupancy.assign(size_t(bucketCapacity()) + 2, 0);
+		stats.overflowLeaves = 0;
+		stats.overflowNodes = 0;
+		stats.blocks = 0;
+		stats.bytesUsed = bytesUsed();
+		vector<int> pending(1, 0);
+		while (!pending.empty()) {
+			const Quadrant& quad = m_quads[pending.back()];
+			pending.pop_back();
+			stats.quadrants++;
+			if (quad.firstChild >= 0) {
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					pending.push_back(quad.firstChild + quadrant);
+				}
+				continue;
+			}
+			size_t depth = size_t(quad.depth);
+			if (depth >= stats.leavesPerDepth.size()) {
+				stats.leavesPerDepth.resize(depth + 1, 0);
+				stats.nodesPerDepth.resize(depth + 1, 0);
+			}
+			stats.leaves++;
+			stats.emptyLeaves += quad.size == 0;
+			stats.depth = std::max(stats.depth, quad.depth);
+			stats.leavesPerDepth[depth]++;
+			stats.nodesPerDepth[depth] += size_t(quad.size);
+			stats.occupancy[std::min(quad.size, bucketCapacity() + 1)]++;
+			stats.blocks += size_t((quad.size + blockSize() - 1) / blockSize());
+			if (quad.size > bucketCapacity()) {
+				stats.overflowLeaves++;
+				stats.overflowNodes += size_t(quad.size - bucketCapacity());
 			}
 		}
+		return stats;
 	}
 
-	/*
-	1 (0 << 1)		1 | 0 = 1
-	0 (1 << 1)		0 | 2 = 2
-	1 (1  << 1)		1 | 2 = 3
-	0 (0 << 1)		0 | 0 = 0
+	/* counts of subdivisions, collapses, search steps... since the tree was created or resetCounters() was called.
+	* all zeros unless QUADTREE_INSTRUMENTATION is defined. counts from concurrent readers are included.
 	*/
+	QuadTreeCounters counters() const
+	{
+		QuadTreeCounters counters = {};
+#ifdef QUADTREE_INSTRUMENTATION
+		counters.subdivisions = m_counters[QuadTreeCounters::SUBDIVISIONS].load(std::memory_order_relaxed);
+		counters.collapses = m_counters[QuadTreeCounters::COLLAPSES].load(std::memory_order_relaxed);
+		counters.collapsedNodes = m_counters[QuadTreeCounters::COLLAPSED_NODES].load(std::memory_order_relaxed);
+		counters.rearrangedNodes = m_counters[QuadTreeCounters::REARRANGED_NODES].load(std::memory_order_relaxed);
+		counters.leafSearches = m_counters[QuadTreeCounters::LEAF_SEARCHES].load(std::memory_order_relaxed);
+		counters.leafSteps = m_counters[QuadTreeCounters::LEAF_STEPS].load(std::memory_order_relaxed);
+		counters.bucketScans = m_counters[QuadTreeCounters::BUCKET_SCANS].load(std::memory_order_relaxed);
+#endif
+		return counters;
+	}
 
-	/*
-	Given node, check which quadrant it would fall into.
-	optimized so that it only does very few instructions to get quadrant
-	TODO: see if you can come up with even faster solution
-	DOESNT CHECK FOR NODES FALLS OUTSIDE QuadTree (which should never happen)
-	if you want to check if a node is outside of quadtree, check it BEFORE calling this function.
-	*/
-	inline int checkQuadrant(const QNode<T> &node) const
+	void resetCounters()
 	{
-		float xMid = m_x + (m_width - m_x) / 2.0f;
-		float yMid = m_y + (m_height - m_y) / 2.0f;
-		int res = (node.x >= xMid) | ((node.y >= yMid) << 1);
-		return res;
+#ifdef QUADTREE_INSTRUMENTATION
+		for (std::atomic<uint64_t>& counter : m_counters) {
+			counter.store(0, std::memory_order_relaxed);
+		}
+#endif
 	}
 
-	/* return the quadrant of where @node would be in given @tree. */
-	int checkQuadrant(const shared_ptr<QuadTree<T>>& tree, const QNode<T> &node) const
+	/* @hook is called with the duration of every insert, remove, update, find, query, nearest, commit, bulkLoad, publish and compact,
+	* pass an empty function to stop. Never called unless QUADTREE_INSTRUMENTATION is defined.
+	* Not thread safe, set it before the tree is shared between threads.
+	*/
+	void setTimingHook(QuadTreeTimingHook hook)
 	{
-		float xMid = tree->getX() + (tree->getWidth() - tree->getX()) / 2.0f;
-		float yMid = tree->getY() + (tree->getHeight() - tree->getY()) / 2.0f;
-		int res = (node.x >= xMid) | ((node.y >= yMid) << 1);
-		return res;
+#ifdef QUADTREE_INSTRUMENTATION
+		m_timingHook = std::move(hook);
+#else
+		(void)hook;
+#endif
 	}
 
-	/* return the quadrant of where @child would be in given @parent.*/
-	int checkQuadrant(const shared_ptr<QuadTree<T>>& parent, const shared_ptr<QuadTree<T>>& child) const
+
+private:
+	template<class U, int C, int D> friend class QuadTree; //join() reads the quadrants and buckets of the other tree.
+	typedef typename QuadTreeSnapshot<T>::Node SnapshotNode;
+	typedef typename QuadWatchList<WatchCallback>::Entry WatchRect;
+
+
+	/* A quadrant of the tree, stored by value in m_quads.
+	* subtrees of a quadrant are 4 consecutive records (NW, NE, SW, SE) starting at firstChild,
+	* nodes of a leaf are stored in a chain of bucket blocks, see appendNode().
+	*/
+	struct Quadrant
 	{
-		float xMid = parent->getX() + (parent->getWidth() - parent->getX()) / 2.0f;
-		float yMid = parent->getY() + (parent->getHeight() - parent->getY()) / 2.0f;
-		int res = (child->getX() >= xMid) | ((child->getY() >= yMid) << 1);
-		return res;
+		float x1, y1, x2, y2;	//boundaries, x2,y2 are the coordinates of the bottom right corner.
+		int parent;				//index of the parent quadrant, -1 for the root. non-owning.
+		int firstChild;			//index of the NW subtree, -1 if the quadrant is a leaf.
+		int currentBucketSize;	//num of nodes in this quadrant and all of its subtrees.
+		int depth;				//cur depth of the quadrant.
+		int firstBlock;			//first bucket block of the leaf, -1 if the bucket is empty.
+		int lastBlock;			//last bucket block of the leaf, new nodes are appended here.
+		int size;				//num of nodes in the bucket of this quadrant.
+	};
+
+	void init(float x1, float y1, float x2, float y2, int bucketCapacity, int depth)
+	{
+		m_bucketCapacity = bucketCapacity;
+		m_maxDepth = depth;
+		m_blockSize = std::max(1, bucketCapacity); //a block holds a full bucket, the +1 before subdividing goes to a second block.
+		m_quads.push_back(makeQuadrant(-1, x1, y1, x2, y2, 0));
+		m_dirty.push_back(1);
+		m_mergePending.push_back(0);
+		m_watches.resizeQuads(1);
+		m_mergeThreshold = bucketCapacity;
+		m_deferMerges = false;
+		m_quadTop = 1;
+		m_freeQuads = -1;
+		m_blockTop = 0;
+		m_freeBlocks = -1;
+		m_indexed = false;
+		resetCounters();
 	}
 
-	/* return the quadrant of where x,y would be in given @tree. */
-	int checkQuadrant(const shared_ptr<QuadTree<T>>& tree, float x, float y) const
+	/* settings of the tree, constants when they're template parameters. */
+	inline int bucketCapacity() const { return Capacity > 0 ? Capacity : m_bucketCapacity; }
+	inline int maxDepth() const { return Capacity > 0 ? MaxDepth : m_maxDepth; }
+	inline int blockSize() const { return Capacity > 0 ? Capacity : m_blockSize; }
+
+	static inline Quadrant makeQuadrant(int parent, float x1, float y1, float x2, float y2, int depth)
 	{
-		float xMid = tree->getX() + (tree->getWidth() - tree->getX()) / 2.0f;
-		float yMid = tree->getY() + (tree->getHeight() - tree->getY()) / 2.0f;
-		int res = (x >= xMid) | ((y >= yMid) << 1);
-		return res;
+		Quadrant quad = { x1, y1, x2, y2, parent, -1, 0, depth, -1, -1, 0 };
+		return quad;
 	}
 
-	//Member variables
-	float m_height;
-	float m_width;
-	float m_x;
-	float m_y;
-	int m_currentBucketSize;	// num of nodes in current bucket. 
-	bool m_isLeaf;				//determine whether or not the newly created quadtree is a leaf
-	int m_curDepth;				//cur depth of the tree.
+	/* returns the index of 4 consecutive unused quadrants, recycled from the free list if possible. */
+	int allocQuadrants()
+	{
+		int index;
+		if (m_freeQuads >= 0) {
+			index = m_freeQuads;
+			m_freeQuads = m_quads[index].firstChild; //free blocks are chained through the first record.
+		}
+		else {
+			index = m_quadTop;
+			m_quadTop += 4;
+			if (size_t(m_quadTop) > m_quads.size()) {
+				m_quads.resize(m_quadTop);
+				m_dirty.resize(m_quadTop);
+				m_mergePending.resize(m_quadTop);
+				m_watches.resizeQuads(m_quadTop);
+			}
+		}
+		return index;
+	}
 
-	//static member variables, these won't change for subtrees, therefore no need to pass them again in the constructor (mo opcode, mo problems!)
-	static int m_bucketCapacity;	//num of nodes per tree before it splitting to subtrees.
-	static int m_maxDepth;			//max time tree can split.
+	inline void freeQuadrants(int index)
+	{
+		m_quads[index].firstChild = m_freeQuads;
+		m_freeQuads = index;
+	}
 
+	/* returns an unused bucket block, recycled from the free list if possible. */
+	int allocBlock()
+	{
+		int block;
+		if (m_freeBlocks >= 0) {
+			block = m_freeBlocks;
+			m_freeBlocks = m_blockNext[block];
+		}
+		else {
+			block = m_blockTop++;
+			if (size_t(m_blockTop) > m_blockNext.size()) {
+				m_points.insert(m_points.end(), blockSize(), QNode<T>(0, 0));
+				m_xs.resize(m_points.size());
+				m_ys.resize(m_points.size());
+				m_slotHandle.resize(m_points.size());
+				m_blockNext.push_back(-1);
+				m_blockOwner.push_back(-1);
+			}
+		}
+		m_blockNext[block] = -1;
+		return block;
+	}
 
-	/* holds pointers to subtrees. */
-	vector<shared_ptr<QuadTree<T>>> m_trees;
+	inline void freeBlock(int block)
+	{
+		m_blockNext[block] = m_freeBlocks;
+		m_freeBlocks = block;
+	}
 
-	//represents quadrants
-	enum quadrants { NW_QUADRANT = 0, NE_QUADRANT = 1, SW_QUADRANT = 2, SE_QUADRANT = 3 };
-	
-	shared_ptr<QuadTree<T>> m_parent; //parent node for any given tree.
-	unordered_set<shared_ptr<QNode<T>>, NodeHashFunc<QNode<T>>, EqualTo<QNode<T>>> m_nodes; //stores nodes in each quadrant.
+	/* Appends @node to the bucket of quadrant @q, a new block is chained when the last one is full.
+	* @node must not point into m_points, allocating a block can move the pool.
+	* @handle is pointed at the new slot.
+	*/
+	void appendNode(int q, QNode<T>&& node, Handle handle)
+	{
+		Quadrant& quad = m_quads[q];
+		int offset = quad.size % blockSize();
+		if (quad.size == 0) {
+			quad.firstBlock = quad.lastBlock = allocBlock();
+			m_blockOwner[quad.lastBlock] = q;
+		}
+		else if (offset == 0) {
+			int block = allocBlock();
+			m_blockNext[quad.lastBlock] = block;
+			m_blockOwner[block] = q;
+			quad.lastBlock = block;
+		}
+		int index = quad.lastBlock * blockSize() + offset;
+		m_xs[index] = node.x;
+		m_ys[index] = node.y;
+		m_points[index] = std::move(node);
+		m_slotHandle[index] = handle;
+		m_handleSlot[handle] = index;
+		quad.size++;
+		touch(q);
+	}
+
+	/* Removes the node at pool @index from the bucket of @q, the last node of the bucket takes its slot.
+	* handle of the removed node isn't touched, it's up to the caller to free or reuse it.
+	*/
+	void eraseNode(int q, int index)
+	{
+		Quadrant& quad = m_quads[q];
+		quad.size--;
+		touch(q);
+		int last = quad.lastBlock * blockSize() + quad.size % blockSize();
+		if (index != last) {
+			m_xs[index] = m_xs[last];
+			m_ys[index] = m_ys[last];
+			m_points[index] = std::move(m_points[last]);
+			m_slotHandle[index] = m_slotHandle[last];
+			m_handleSlot[m_slotHandle[index]] = index;
+		}
+		if (quad.size % blockSize() != 0) {
+			return;
+		}
+		//last block is empty now, give it back.
+		if (quad.size == 0) {
+			freeBlock(quad.firstBlock);
+			quad.firstBlock = quad.lastBlock = -1;
+			return;
+		}
+		int prev = quad.firstBlock;
+		while (m_blockNext[prev] != quad.lastBlock) {
+			prev = m_blockNext[prev];
+		}
+		freeBlock(quad.lastBlock);
+		m_blockNext[prev] = -1;
+		quad.lastBlock = prev;
+	}
+
+	/* Calls @fn(base, count) for every block in the bucket of @q, the block holds pool indices [base, base + count). */
+	template<class Fn>
+	inline void forEachBlock(int q, Fn fn) const
+	{
+		int remaining = m_quads[q].size;
+		for (int block = m_quads[q].firstBlock; remaining > 0; block = m_blockNext[block]) {
+			int count = std::min(remaining, blockSize());
+			fn(block * blockSize(), count);
+			remaining -= count;
+		}
+	}
+
+	/* Calls @fn(const QNode<T>&) on every node in the bucket of @q */
+	template<class Fn>
+	void forEachInBucket(int q, Fn fn) const
+	{
+		forEachBlock(q, [&](int base, int count) {
+			for (int i = base; i < base + count; ++i) {
+				fn(m_points[i]);
+			}
+		});
+	}
+
+	/* returns the pool index of the node at x,y in the bucket of @q, -1 if it's not there. */
+	int findInBucket(int q, float x, float y) const
+	{
+		int remaining = m_quads[q].size;
+		for (int block = m_quads[q].firstBlock; remaining > 0; block = m_blockNext[block]) {
+			int count = std::min(remaining, blockSize());
+			const float* xs = &m_xs[size_t(block) * blockSize()];
+			const float* ys = &m_ys[size_t(block) * blockSize()];
+			for (int i = 0; i < count; ++i) {
+				if (xs[i] == x && ys[i] == y) {
+					QUADTREE_COUNT(BUCKET_SCANS, m_quads[q].size - remaining + i + 1);
+					return block * blockSize() + i;
+				}
+			}
+			remaining -= count;
+		}
+		QUADTREE_COUNT(BUCKET_SCANS, m_quads[q].size);
+		return -1;
+	}
+
+	/* returns the pool index of the node at x,y, -1 if it's not in the tree. one probe with the point index, a descent without. */
+	int findSlot(float x, float y) const
+	{
+		if (m_indexed) {
+			int handle = m_pointIndex.find(x, y);
+			return handle >= 0 ? m_handleSlot[handle] : -1;
+		}
+		return findInBucket(leafHelper(x, y), x, y);
+	}
+
+	/* true if a node sits at x,y, @leaf is the leaf x,y belongs to. */
+	inline bool occupied(int leaf, float x, float y) const
+	{
+		return m_indexed ? m_pointIndex.find(x, y) >= 0 : findInBucket(leaf, x, y) >= 0;
+	}
+
+	/* keeps the point index in sync when the node at pool @index is about to move to x,y. */
+	inline void reindex(int index, float x, float y)
+	{
+		if (m_indexed) {
+			m_pointIndex.erase(m_xs[index], m_ys[index]);
+			m_pointIndex.insert(x, y, m_slotHandle[index]);
+		}
+	}
+
+	/* fills the point index with every node of the tree. */
+	void rebuildPointIndex()
+	{
+		m_pointIndex.clear();
+		m_pointIndex.reserve(size_t(size()));
+		vector<int> pending(1, 0);
+		while (!pending.empty()) {
+			int q = pending.back();
+			pending.pop_back();
+			if (m_quads[q].firstChild >= 0) {
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					pending.push_back(m_quads[q].firstChild + quadrant);
+				}
+				continue;
+			}
+			forEachBlock(q, [this](int base, int count) {
+				for (int i = base; i < base + count; ++i) {
+					m_pointIndex.insert(m_xs[i], m_ys[i], m_slotHandle[i]);
+				}
+			});
+		}
+	}
+
+	/* returns an unused handle, recycled from the free list if possible. */
+	Handle allocHandle()
+	{
+		if (!m_freeHandles.empty()) {
+			Handle handle = m_freeHandles.back();
+			m_freeHandles.pop_back();
+			return handle;
+		}
+		m_handleSlot.push_back(-1);
+		return Handle(m_handleSlot.size() - 1);
+	}
+
+	inline void freeHandle(Handle handle)
+	{
+		m_handleSlot[handle] = -1;
+		m_freeHandles.push_back(handle);
+	}
+
+	/* Removes the node at pool @index from leaf @qTree, updates the bucket sizes up to the root then reduces the tree. */
+	void removeHelper(int qTree, int index)
+	{
+		notifyWatches(qTree, qTree, m_points[index], m_xs[index], m_ys[index], NAN_COORD, NAN_COORD);
+		if (m_indexed) {
+			m_pointIndex.erase(m_xs[index], m_ys[index]);
+		}
+		freeHandle(m_slotHandle[index]);
+		eraseNode(qTree, index);
+		for (int q = qTree; q >= 0; q = m_quads[q].parent) {
+			m_quads[q].currentBucketSize--;
+		}
+		removeSubtree(qTree);
+	}
+
+	/* Should be called on the leaf a node was removed from, bucket sizes must already be updated.
+	* Finds the highest ancestor of @tree whose subtrees hold getMergeThreshold() nodes or less,
+	* moves every node below it into its bucket and gives its subtrees back to the pool.
+	* O(log4(N)) to find the ancestor, O(K) to move the nodes. When merges are deferred @tree is only marked for compact().
+	*/
+	void removeSubtree(int tree)
+	{
+		if (m_deferMerges) {
+			markMerge(tree);
+			return;
+		}
+		int top = reductionRoot(tree);
+		if (top >= 0) {
+			reduce(top);
+		}
+	}
+
+	/* returns the highest ancestor of @tree whose subtrees hold getMergeThreshold() nodes or less, -1 if there isn't one. */
+	int reductionRoot(int tree) const
+	{
+		int top = -1;
+		for (int q = m_quads[tree].parent; q >= 0 && m_quads[q].currentBucketSize <= m_mergeThreshold; q = m_quads[q].parent) {
+			top = q;
+		}
+		return top;
+	}
+
+	/* moves every node below @top into its bucket, @top becomes a leaf. */
+	void reduce(int top)
+	{
+		QUADTREE_COUNT(COLLAPSES, 1);
+		QUADTREE_COUNT(COLLAPSED_NODES, m_quads[top].currentBucketSize);
+		int first = m_quads[top].firstChild;
+		m_quads[top].firstChild = -1;
+		touch(top);
+		collapseHelper(top, first);
+	}
+
+	/* Marks @tree and its ancestors for compact(), stops at the first ancestor that's already marked (same as touch()). */
+	inline void markMerge(int tree)
+	{
+		for (int q = tree; q >= 0 && !m_mergePending[q]; q = m_quads[q].parent) {
+			m_mergePending[q] = 1;
+		}
+	}
+
+	/* Part of compact(), merges @q if it holds few enough nodes, otherwise looks into its marked subtrees. */
+	void compactHelper(int q, size_t& merged)
+	{
+		m_mergePending[q] = 0;
+		if (m_quads[q].firstChild < 0) {
+			return;
+		}
+		if (m_quads[q].currentBucketSize <= m_mergeThreshold) {
+			reduce(q);
+			merged++;
+			return;
+		}
+		int first = m_quads[q].firstChild;
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			if (m_mergePending[first + quadrant]) {
+				compactHelper(first + quadrant, merged);
+			}
+		}
+	}
+
+	/* moves the nodes of the 4 subtrees starting at @first (and their subtrees) into the bucket of @target, frees them. */
+	void collapseHelper(int target, int first)
+	{
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			int q = first + quadrant;
+			m_watches.moveAll(q, target);
+			if (m_quads[q].firstChild >= 0) {
+				collapseHelper(target, m_quads[q].firstChild);
+				continue;
+			}
+			while (m_quads[q].size > 0) {
+				int last = m_quads[q].lastBlock * blockSize() + (m_quads[q].size - 1) % blockSize();
+				QNode<T> node(std::move(m_points[last]));
+				Handle handle = m_slotHandle[last];
+				eraseNode(q, last);
+				appendNode(target, std::move(node), handle);
+			}
+		}
+		freeQuadrants(first);
+	}
+
+	/* Attaches watch @id to the deepest quadrant below @q every point of its rectangle descends through,
+	* the descent picks subtrees the way checkQuadrant does, so points outside of the tree take the same path.
+	*/
+	void placeWatch(int id, int q)
+	{
+		const WatchRect& rect = m_watches.rect(id);
+		while (m_quads[q].firstChild >= 0) {
+			const Quadrant& quad = m_quads[q];
+			float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+			float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+			bool east = rect.x1 >= xMid, south = rect.y1 >= yMid;
+			//the rectangle straddles a midline.
+			if ((!east && rect.x2 >= xMid) || (!south && rect.y2 >= yMid)) {
+				break;
+			}
+			q = quad.firstChild + (int(east) | (int(south) << 1));
+		}
+		m_watches.attach(id, q);
+	}
+
+	/* moves the watches of @q down to the subtrees that contain them, called once @q is divided. */
+	void pushWatches(int q)
+	{
+		if (m_watches.size() == 0) {
+			return;
+		}
+		//backwards: detaching swaps the last watch in, attaching appends, so the ones left to visit stay in front.
+		for (int i = int(m_watches.at(q).size()) - 1; i >= 0; --i) {
+			int id = m_watches.at(q)[i].id;
+			m_watches.detach(id);
+			placeWatch(id, q);
+		}
+	}
+
+	/* calls @fn(id) for every watch. */
+	template<class Fn>
+	void forEachWatch(Fn fn) const
+	{
+		for (size_t id = 0; id < m_watches.slots(); ++id) {
+			if (m_watches.isValid(int(id))) {
+				fn(int(id));
+			}
+		}
+	}
+
+	/* calls @fn(node) for every node below @q inside the rectangle of watch @id, nodes outside of the tree included. */
+	template<class Fn>
+	void forEachWatched(int q, int id, const Fn& fn) const
+	{
+		float x1, y1, x2, y2;
+		extent(q, x1, y1, x2, y2);
+		const Quadrant& quad = m_quads[q];
+		const WatchRect& rect = m_watches.rect(id);
+		if (quad.currentBucketSize == 0 || rect.x1 > x2 || x1 > rect.x2 || rect.y1 > y2 || y1 > rect.y2) {
+			return;
+		}
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				forEachWatched(quad.firstChild + quadrant, id, fn);
+			}
+			return;
+		}
+		forEachBlock(q, [&](int base, int count) {
+			for (int i = base; i < base + count; ++i) {
+				if (rect.contains(m_xs[i], m_ys[i])) {
+					fn(m_points[i]);
+				}
+			}
+		});
+	}
+
+	/* Reports @node to the watches attached to @q whose rectangle it entered or left going from fromX,fromY to toX,toY.
+	* NAN_COORD is in no rectangle: from NAN_COORD is an insertion, to NAN_COORD a removal.
+	*/
+	inline void notifyQuadrant(int q, const QNode<T>& node, float fromX, float fromY, float toX, float toY) const
+	{
+		for (const WatchRect& rect : m_watches.at(q)) {
+			bool was = rect.contains(fromX, fromY);
+			if (was != rect.contains(toX, toY)) {
+				m_watches.callback(rect.id)(node, was ? WATCH_EXIT : WATCH_ENTER);
+			}
+		}
+	}
+
+	/* Reports @node, which went from fromX,fromY in leaf @from to toX,toY in leaf @to, to the watches it crossed.
+	* Every watch that contains a point is attached to its path from the root (see placeWatch()), so only the two paths are visited,
+	* each quadrant once: they're walked up in lockstep until they join.
+	*/
+	void notifyWatches(int from, int to, const QNode<T>& node, float fromX, float fromY, float toX, float toY) const
+	{
+		if (m_watches.size() == 0) {
+			return;
+		}
+		while (from != to) {
+			if (m_quads[from].depth >= m_quads[to].depth) {
+				notifyQuadrant(from, node, fromX, fromY, toX, toY);
+				from = m_quads[from].parent;
+			}
+			else {
+				notifyQuadrant(to, node, fromX, fromY, toX, toY);
+				to = m_quads[to].parent;
+			}
+		}
+		for (int q = from; q >= 0; q = m_quads[q].parent) {
+			notifyQuadrant(q, node, fromX, fromY, toX, toY);
+		}
+	}
+
+	/* Given quadrant and x,y check if x,y would be placed in @q, ties on the boundaries are resolved the way checkQuadrant does,
+	* nodes outside of the tree belong to the quadrants along the edge.
+	*/
+	bool couldFit(int q, float x, float y) const
+	{
+		const Quadrant& quad = m_quads[q];
+		const Quadrant& root = m_quads[0];
+		return (x >= quad.x1 || quad.x1 == root.x1) && (x < quad.x2 || quad.x2 == root.x2)
+			&& (y >= quad.y1 || quad.y1 == root.y1) && (y < quad.y2 || quad.y2 == root.y2);
+	}
+
+	/* returns the leaf x,y belongs to, searched from the lowest ancestor of @leaf that contains x,y.
+	* root always fits, nodes outside of the tree belong to the quadrants along the edge.
+	*/
+	int targetLeaf(int leaf, float x, float y) const
+	{
+		int ancestor = leaf;
+		while (!couldFit(ancestor, x, y)) {
+			ancestor = m_quads[ancestor].parent;
+		}
+		return leafHelper(ancestor, x, y);
+	}
+
+	/* Moves the node at pool @index from @leaf to x,y in @target, x,y must belong to @target.
+	* Bucket sizes are updated up to the lowest common ancestor of the two leaves, quadrants aren't reduced or divided.
+	*/
+	void moveNode(int index, int leaf, int target, float x, float y)
+	{
+		reindex(index, x, y);
+		QNode<T> moved(std::move(m_points[index]));
+		moved.x = x;
+		moved.y = y;
+		Handle handle = m_slotHandle[index];
+		eraseNode(leaf, index);
+		int ancestor = leaf;
+		for (; !couldFit(ancestor, x, y); ancestor = m_quads[ancestor].parent) {
+			m_quads[ancestor].currentBucketSize--;
+		}
+		appendNode(target, std::move(moved), handle);
+		for (int q = target; q != ancestor; q = m_quads[q].parent) {
+			m_quads[q].currentBucketSize++;
+		}
+	}
+
+	/* update(Handle, x, y) without the timer, update(QNode&, x, y) times itself. */
+	bool updateHelper(Handle handle, float x, float y)
+	{
+		if (!isValid(handle)) {
+			return false;
+		}
+		int index = m_handleSlot[handle];
+		int leaf = m_blockOwner[index / blockSize()];
+		if (m_xs[index] == x && m_ys[index] == y) {
+			return true;
+		}
+		int target = targetLeaf(leaf, x, y);
+		if (occupied(target, x, y)) {
+			return false;
+		}
+
+		float oldX = m_xs[index], oldY = m_ys[index];
+		if (target == leaf) {
+			reindex(index, x, y);
+			QNode<T>& stored = m_points[index];
+			stored.x = m_xs[index] = x;
+			stored.y = m_ys[index] = y;
+			touch(leaf);
+			notifyWatches(leaf, leaf, stored, oldX, oldY, x, y);
+			return true;
+		}
+		moveNode(index, leaf, target, x, y);
+		notifyWatches(leaf, target, m_points[m_handleSlot[handle]], oldX, oldY, x, y);
+		/* every subtree has more than getMergeThreshold() nodes, otherwise it would've been reduced already (or merges are deferred).
+		* bucket size of the common ancestor didn't change, so the reduction stops below it and never reaches @target.
+		*/
+		removeSubtree(leaf);
+		if (needsSplit(target)) {
+			subdivide(target);
+		}
+		return true;
+	}
+
+	/* Helper function, used by find() and remove(), given x,y finds the leaf quadrant the node *would* be in if it exist
+	* takes O(log4(N)) time to find the quadrant.
+	*/
+	int leafHelper(float x, float y) const
+	{
+		return leafHelper(0, x, y);
+	}
+
+	/* same as above, starts the search from quadrant @q instead of the root. */
+	int leafHelper(int q, float x, float y) const
+	{
+		int currentHead = q;
+		while (m_quads[currentHead].firstChild >= 0) {
+			currentHead = m_quads[currentHead].firstChild + checkQuadrant(m_quads[currentHead], x, y);
+		}
+		QUADTREE_COUNT(LEAF_SEARCHES, 1);
+		QUADTREE_COUNT(LEAF_STEPS, m_quads[currentHead].depth - m_quads[q].depth);
+		return currentHead;
+	}
+
+	/* Marks @q and its ancestors as modified since the last publish().
+	* stops at the first ancestor that's already marked, ancestors of a marked quadrant are always marked.
+	*/
+	inline void touch(int q)
+	{
+		for (; q >= 0 && !m_dirty[q]; q = m_quads[q].parent) {
+			m_dirty[q] = 1;
+		}
+	}
+
+	/* Returns the snapshot of quadrant @q, @previous is the node at the same position in the last snapshot (nullptr if there isn't one).
+	* Unmodified quadrants return @previous as is, modified ones are copied and their marks are cleared.
+	*/
+	std::shared_ptr<const SnapshotNode> publishHelper(int q, const std::shared_ptr<const SnapshotNode>* previous)
+	{
+		if (previous != nullptr && *previous && !m_dirty[q]) {
+			return *previous;
+		}
+		m_dirty[q] = 0;
+		const Quadrant& quad = m_quads[q];
+		std::shared_ptr<SnapshotNode> node = std::make_shared<SnapshotNode>();
+		extent(q, node->x1, node->y1, node->x2, node->y2);
+		node->count = quad.currentBucketSize;
+		if (quad.firstChild >= 0) {
+			//children of a leaf in the last snapshot are new records, nothing to share.
+			bool shared = previous != nullptr && *previous && (*previous)->children[0];
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				node->children[quadrant] = publishHelper(quad.firstChild + quadrant, shared ? &(*previous)->children[quadrant] : nullptr);
+			}
+			return node;
+		}
+		node->xs.reserve(quad.size);
+		node->ys.reserve(quad.size);
+		node->points.reserve(quad.size);
+		forEachBlock(q, [&](int base, int count) {
+			node->xs.insert(node->xs.end(), m_xs.begin() + base, m_xs.begin() + base + count);
+			node->ys.insert(node->ys.end(), m_ys.begin() + base, m_ys.begin() + base + count);
+			node->points.insert(node->points.end(), m_points.begin() + base, m_points.begin() + base + count);
+		});
+		return node;
+	}
+
+	/* true if the rectangle x1,y1 - x2,y2 overlaps the extent() of @q, so nodes outside of the tree are found too. */
+	inline bool overlaps(int q, float x1, float y1, float x2, float y2) const
+	{
+		float qx1, qy1, qx2, qy2;
+		extent(q, qx1, qy1, qx2, qy2);
+		return x1 <= qx2 && qx1 <= x2 && y1 <= qy2 && qy1 <= y2;
+	}
+
+	/* squared distance between x,y and the closest point of the extent() of @q, 0 if x,y is inside. */
+	inline float minDistSq(int q, float x, float y) const
+	{
+		float qx1, qy1, qx2, qy2;
+		extent(q, qx1, qy1, qx2, qy2);
+		float dx = (x < qx1) ? qx1 - x : (x > qx2 ? x - qx2 : 0.0f);
+		float dy = (y < qy1) ? qy1 - y : (y > qy2 ? y - qy2 : 0.0f);
+		return dx * dx + dy * dy;
+	}
+
+	/* Recursively visits the quadrants overlapping the rectangle, only leaves hold nodes. */
+	template<class Visitor>
+	void queryHelper(int q, float x1, float y1, float x2, float y2, Visitor& visitor) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				if (overlaps(quad.firstChild + quadrant, x1, y1, x2, y2)) {
+					queryHelper(quad.firstChild + quadrant, x1, y1, x2, y2, visitor);
+				}
+			}
+			return;
+		}
+		int hits[QuadSimd::CHUNK];
+		forEachBlock(q, [&](int base, int count) {
+			for (int offset = base; offset < base + count; offset += QuadSimd::CHUNK) {
+				int found = QuadSimd::filterRect(&m_xs[offset], &m_ys[offset], std::min<int>(QuadSimd::CHUNK, base + count - offset), x1, y1, x2, y2, hits);
+				for (int i = 0; i < found; ++i) {
+					visitor(m_points[offset + hits[i]]);
+				}
+			}
+		});
+	}
+
+	/* same as queryHelper but prunes by the squared distance to cx,cy */
+	template<class Visitor>
+	void queryCircleHelper(int q, float cx, float cy, float radiusSq, Visitor& visitor) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				if (minDistSq(quad.firstChild + quadrant, cx, cy) <= radiusSq) {
+					queryCircleHelper(quad.firstChild + quadrant, cx, cy, radiusSq, visitor);
+				}
+			}
+			return;
+		}
+		int hits[QuadSimd::CHUNK];
+		forEachBlock(q, [&](int base, int count) {
+			for (int offset = base; offset < base + count; offset += QuadSimd::CHUNK) {
+				int found = QuadSimd::filterCircle(&m_xs[offset], &m_ys[offset], std::min<int>(QuadSimd::CHUNK, base + count - offset), cx, cy, radiusSq, hits);
+				for (int i = 0; i < found; ++i) {
+					visitor(m_points[offset + hits[i]]);
+				}
+			}
+		});
+	}
+
+	/* Calls @hit(node, t, maxT) for every node of @q that @ray hits at t <= maxT, leaves are visited front to back.
+	* @hit can lower maxT, subtrees the ray enters past it are skipped. Subtrees are tested against their extent() so nodes
+	* outside of the tree are hit too.
+	*/
+	template<class Hit>
+	void castHelper(int q, const QuadRay& ray, float& maxT, Hit&& hit) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int i = 0; i < 4; ++i) {
+				int child = quad.firstChild + (i ^ ray.order);
+				float x1, y1, x2, y2, t;
+				extent(child, x1, y1, x2, y2);
+				if (m_quads[child].currentBucketSize > 0 && ray.entersBox(x1, y1, x2, y2, maxT, t)) {
+					castHelper(child, ray, maxT, hit);
+				}
+			}
+			return;
+		}
+		forEachBlock(q, [&](int base, int count) {
+			for (int i = base; i < base + count; ++i) {
+				float t;
+				if (ray.hitsPoint(m_xs[i], m_ys[i], t) && t <= maxT) {
+					hit(m_points[i], t, maxT);
+				}
+			}
+		});
+	}
+
+	/* boundaries of @q, the ones on the edge of the tree are moved to infinity since nodes outside of the tree are kept in the quadrants along the edge. */
+	inline void extent(int q, float& x1, float& y1, float& x2, float& y2) const
+	{
+		const Quadrant& quad = m_quads[q];
+		const Quadrant& root = m_quads[0];
+		const float inf = std::numeric_limits<float>::infinity();
+		x1 = quad.x1 == root.x1 ? -inf : quad.x1;
+		y1 = quad.y1 == root.y1 ? -inf : quad.y1;
+		x2 = quad.x2 == root.x2 ? inf : quad.x2;
+		y2 = quad.y2 == root.y2 ? inf : quad.y2;
+	}
+
+	/* squared distance between the nodes of quadrant @a and quadrant @b of @other can't be less than this, 0 if they touch. */
+	template<class U, int C, int D>
+	float gapSq(int a, const QuadTree<U, C, D>& other, int b) const
+	{
+		float ax1, ay1, ax2, ay2, bx1, by1, bx2, by2;
+		extent(a, ax1, ay1, ax2, ay2);
+		other.extent(b, bx1, by1, bx2, by2);
+		float dx = std::max(std::max(bx1 - ax2, ax1 - bx2), 0.0f);
+		float dy = std::max(std::max(by1 - ay2, ay1 - by2), 0.0f);
+		return dx * dx + dy * dy;
+	}
+
+	/* calls @visitor(m_points[i], node) for every node of @other at pool index [first, last) within sqrt(@distSq) of node i. */
+	template<class U, int C, int D, class Visitor>
+	inline void joinNode(int i, const QuadTree<U, C, D>& other, int first, int last, float distSq, Visitor& visitor) const
+	{
+		int hits[QuadSimd::CHUNK];
+		for (int offset = first; offset < last; offset += QuadSimd::CHUNK) {
+			int found = QuadSimd::filterCircle(&other.m_xs[offset], &other.m_ys[offset], std::min<int>(QuadSimd::CHUNK, last - offset), m_xs[i], m_ys[i], distSq, hits);
+			for (int k = 0; k < found; ++k) {
+				visitor(m_points[i], other.m_points[offset + hits[k]]);
+			}
+		}
+	}
+
+	/* pairs within the bucket of leaf @q, every node is compared with the nodes after it. */
+	template<class Visitor>
+	void joinLeaf(int q, float distSq, Visitor& visitor) const
+	{
+		int remaining = m_quads[q].size;
+		for (int block = m_quads[q].firstBlock; remaining > 0; block = m_blockNext[block]) {
+			int count = std::min(remaining, blockSize());
+			int base = block * blockSize();
+			remaining -= count;
+			for (int i = base; i < base + count; ++i) {
+				joinNode(i, *this, i + 1, base + count, distSq, visitor);
+				int rest = remaining;
+				for (int other = m_blockNext[block]; rest > 0; other = m_blockNext[other]) {
+					int otherCount = std::min(rest, blockSize());
+					joinNode(i, *this, other * blockSize(), other * blockSize() + otherCount, distSq, visitor);
+					rest -= otherCount;
+				}
+			}
+		}
+	}
+
+	template<class Visitor>
+	void selfJoinHelper(int q, float distSq, Visitor& visitor) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild < 0) {
+			joinLeaf(q, distSq, visitor);
+			return;
+		}
+		for (int a = 0; a < 4; ++a) {
+			selfJoinHelper(quad.firstChild + a, distSq, visitor);
+			for (int b = a + 1; b < 4; ++b) {
+				crossJoinHelper(quad.firstChild + a, *this, quad.firstChild + b, distSq, visitor);
+			}
+		}
+	}
+
+	/* true if the pair @a, @b of @other should be joined by dividing @a, false to divide @b. the larger quadrant is divided. */
+	template<class U, int C, int D>
+	inline bool splitFirst(int a, const QuadTree<U, C, D>& other, int b) const
+	{
+		const Quadrant& qa = m_quads[a];
+		const typename QuadTree<U, C, D>::Quadrant& qb = other.m_quads[b];
+		return qa.firstChild >= 0 && (qb.firstChild < 0 || (qa.x2 - qa.x1) * (qa.y2 - qa.y1) >= (qb.x2 - qb.x1) * (qb.y2 - qb.y1));
+	}
+
+	/* pairs with one node in subtree @a and the other in subtree @b of @other (which can be this tree, as long as @a and @b don't overlap).
+	* The larger of the two is divided until both are leaves, pairs of subtrees farther than sqrt(@distSq) are skipped.
+	*/
+	template<class U, int C, int D, class Visitor>
+	void crossJoinHelper(int a, const QuadTree<U, C, D>& other, int b, float distSq, Visitor& visitor) const
+	{
+		const Quadrant& qa = m_quads[a];
+		const typename QuadTree<U, C, D>::Quadrant& qb = other.m_quads[b];
+		if (qa.currentBucketSize == 0 || qb.currentBucketSize == 0 || gapSq(a, other, b) > distSq) {
+			return;
+		}
+		if (splitFirst(a, other, b)) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				crossJoinHelper(qa.firstChild + quadrant, other, b, distSq, visitor);
+			}
+			return;
+		}
+		if (qb.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				crossJoinHelper(a, other, qb.firstChild + quadrant, distSq, visitor);
+			}
+			return;
+		}
+		forEachBlock(a, [&](int base, int count) {
+			for (int i = base; i < base + count; ++i) {
+				other.forEachBlock(b, [&](int otherBase, int otherCount) {
+					joinNode(i, other, otherBase, otherBase + otherCount, distSq, visitor);
+				});
+			}
+		});
+	}
+
+	/* visitor of the parallel joins, appends pairs to the buffer of the thread running the task. */
+	template<class U>
+	struct AppendPair
+	{
+		vector<std::pair<const QNode<T>*, const QNode<U>*>>* out;
+		inline void operator()(const QNode<T>& a, const QNode<U>& b) const { out->push_back(std::make_pair(&a, &b)); }
+	};
+
+	/* Task of selfJoin(..., pool, buffers), small subtrees are joined on the current thread,
+	* large ones are split into a task per subtree and a task per pair of subtrees.
+	*/
+	void parallelSelfJoin(int q, float distSq, ThreadPool& pool, vector<vector<NodePair>>& buffers) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild < 0 || quad.currentBucketSize < JOIN_PARALLEL_CUTOFF) {
+			AppendPair<T> visitor = { &buffers[pool.threadIndex()] };
+			selfJoinHelper(q, distSq, visitor);
+			return;
+		}
+		for (int a = 0; a < 4; ++a) {
+			int child = quad.firstChild + a;
+			pool.submit([this, child, distSq, &pool, &buffers] { parallelSelfJoin(child, distSq, pool, buffers); });
+			for (int b = a + 1; b < 4; ++b) {
+				int sibling = quad.firstChild + b;
+				pool.submit([this, child, sibling, distSq, &pool, &buffers] { parallelCrossJoin(child, *this, sibling, distSq, pool, buffers); });
+			}
+		}
+	}
+
+	/* Task of the parallel joins for pairs between subtree @a and subtree @b of @other, large pairs are split into a task per pair of subtrees. */
+	template<class U, int C, int D>
+	void parallelCrossJoin(int a, const QuadTree<U, C, D>& other, int b, float distSq, ThreadPool& pool,
+		vector<vector<std::pair<const QNode<T>*, const QNode<U>*>>>& buffers) const
+	{
+		const Quadrant& qa = m_quads[a];
+		const typename QuadTree<U, C, D>::Quadrant& qb = other.m_quads[b];
+		bool first = splitFirst(a, other, b);
+		if (qa.currentBucketSize + qb.currentBucketSize < JOIN_PARALLEL_CUTOFF || (!first && qb.firstChild < 0) || gapSq(a, other, b) > distSq) {
+			AppendPair<U> visitor = { &buffers[pool.threadIndex()] };
+			crossJoinHelper(a, other, b, distSq, visitor);
+			return;
+		}
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			int childA = first ? qa.firstChild + quadrant : a;
+			int childB = first ? b : qb.firstChild + quadrant;
+			pool.submit([this, childA, &other, childB, distSq, &pool, &buffers] { parallelCrossJoin(childA, other, childB, distSq, pool, buffers); });
+		}
+	}
+
+	template<class Fn>
+	void forEachHelper(int q, Fn& fn) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild >= 0) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				forEachHelper(quad.firstChild + quadrant, fn);
+			}
+			return;
+		}
+		forEachInBucket(q, [&fn](const QNode<T>& node) { fn(node); });
+	}
+
+	/* Task of forEach(pool, fn), subtrees with fewer than TRAVERSAL_PARALLEL_CUTOFF nodes are visited serially. */
+	template<class Fn>
+	void parallelForEach(int q, ThreadPool& pool, Fn& fn) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.firstChild < 0 || quad.currentBucketSize < TRAVERSAL_PARALLEL_CUTOFF) {
+			forEachHelper(q, fn);
+			return;
+		}
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			int child = quad.firstChild + quadrant;
+			pool.submit([this, child, &pool, &fn] { parallelForEach(child, pool, fn); });
+		}
+	}
+
+	/* Best-first k nearest neighbor search used by nearest() and nearestWithin().
+	* @pending is a min-heap of subtrees ordered by the distance to their boundaries,
+	* @best is a max-heap of the k closest nodes found so far, so its top is the distance any remaining subtree has to beat.
+	*/
+	void nearestHelper(float x, float y, size_t k, float maxDistSq, vector<const QNode<T>*>& out) const
+	{
+		QUADTREE_TIME(NEAREST_OPERATION);
+		if (k == 0) {
+			return;
+		}
+		typedef std::pair<float, int> QuadrantDist;
+		typedef std::pair<float, const QNode<T>*> NodeDist;
+		std::priority_queue<QuadrantDist, vector<QuadrantDist>, std::greater<QuadrantDist>> pending;
+		std::priority_queue<NodeDist> best;
+
+		pending.emplace(minDistSq(0, x, y), 0);
+		while (!pending.empty()) {
+			QuadrantDist top = pending.top();
+			pending.pop();
+			float bound = (best.size() == k) ? best.top().first : maxDistSq;
+			if (top.first > bound) {
+				break; //every remaining subtree is farther than the k-th best node.
+			}
+
+			const Quadrant& quad = m_quads[top.second];
+			if (quad.firstChild >= 0) {
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					int child = quad.firstChild + quadrant;
+					float distSq = minDistSq(child, x, y);
+					if (distSq <= maxDistSq && (best.size() < k || distSq < best.top().first)) {
+						pending.emplace(distSq, child);
+					}
+				}
+				continue;
+			}
+			forEachBlock(top.second, [&](int base, int count) {
+				for (int i = base; i < base + count; ++i) {
+					float dx = m_xs[i] - x;
+					float dy = m_ys[i] - y;
+					float distSq = dx * dx + dy * dy;
+					if (distSq > maxDistSq) {
+						continue;
+					}
+					if (best.size() < k) {
+						best.emplace(distSq, &m_points[i]);
+					}
+					else if (distSq < best.top().first) {
+						best.pop();
+						best.emplace(distSq, &m_points[i]);
+					}
+				}
+			});
+		}
+
+		//best pops farthest first, fill the output from the back.
+		size_t start = out.size();
+		out.resize(start + best.size());
+		for (size_t i = out.size(); i > start; --i) {
+			out[i - 1] = best.top().second;
+			best.pop();
+		}
+	}
+
+	/* Helper func used by all the insert functions.
+	* Finds the leaf quadrant of @node, duplicates are ignored.
+	*	1) if current size is less than the max, insert the element onto that node.
+	*	2) if current depth is less than the max, subdivide the tree, which moves the bucket to the subtrees.
+	*	3) otherwise we reached max depth and max capacity, we can't divide any more but we can still override max capacity and insert them onto the current node
+	* returns the handle of the node, INVALID_HANDLE if a node with the same coordinates is already in the tree.
+	*/
+	Handle insertHelper(QNode<T> node)
+	{
+		QUADTREE_TIME(INSERT_OPERATION);
+		if (m_indexed && m_pointIndex.find(node.x, node.y) >= 0) {
+			return INVALID_HANDLE;
+		}
+		int qTree = leafHelper(node.x, node.y);
+		if (!m_indexed && findInBucket(qTree, node.x, node.y) >= 0) {
+			return INVALID_HANDLE;
+		}
+		Handle handle = allocHandle();
+		if (m_indexed) {
+			m_pointIndex.insert(node.x, node.y, handle);
+		}
+		appendNode(qTree, std::move(node), handle);
+		for (int q = qTree; q >= 0; q = m_quads[q].parent) {
+			m_quads[q].currentBucketSize++;
+		}
+		if (needsSplit(qTree)) {
+			subdivide(qTree);
+		}
+		if (m_watches.size() > 0) {
+			int index = m_handleSlot[handle];
+			int leaf = m_blockOwner[index / blockSize()];
+			notifyWatches(leaf, leaf, m_points[index], NAN_COORD, NAN_COORD, m_xs[index], m_ys[index]);
+		}
+		return handle;
+	}
+
+	/* true if leaf @q is over the bucket capacity and dividing it can separate its nodes.
+	* Leaves stay over capacity at max depth, once the midpoints can't move anymore (float precision),
+	* and when every node is outside of @q and in the same subtree: nodes outside of the tree are kept in the edge quadrants,
+	* each division would send all of them to the same corner subtree again, forever.
+	*/
+	bool needsSplit(int q) const
+	{
+		const Quadrant& quad = m_quads[q];
+		if (quad.size <= bucketCapacity() || quad.depth >= maxDepth()) {
+			return false;
+		}
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		if (!(quad.x1 < xMid && xMid < quad.x2 && quad.y1 < yMid && yMid < quad.y2)) {
+			return false;
+		}
+		bool stuck = true;
+		int corner = -1;
+		forEachBlock(q, [&](int base, int count) {
+			for (int i = base; i < base + count && stuck; ++i) {
+				int quadrant = (m_xs[i] >= xMid) | ((m_ys[i] >= yMid) << 1);
+				bool inside = m_xs[i] >= quad.x1 && m_xs[i] <= quad.x2 && m_ys[i] >= quad.y1 && m_ys[i] <= quad.y2;
+				stuck = !inside && (corner < 0 || quadrant == corner);
+				corner = quadrant;
+			}
+		});
+		return !stuck;
+	}
+
+	/* divides quadrant @q to 4 quadrants taken from the pool
+	* and pushes the nodes of @q to them, subtrees that are still over capacity are divided again.
+	*/
+	void subdivide(int q)
+	{
+		QUADTREE_COUNT(SUBDIVISIONS, 1);
+		int first = allocQuadrants();
+		Quadrant& quad = m_quads[q];
+		//x2 and y2 are coordinates, so split on the midpoint, same as checkQuadrant()
+		float newXRegion = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float newYRegion = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		int depth = quad.depth + 1;
+
+		//NW, NE, SW, SE
+		m_quads[first + NW_QUADRANT] = makeQuadrant(q, quad.x1, quad.y1, newXRegion, newYRegion, depth);
+		m_quads[first + NE_QUADRANT] = makeQuadrant(q, newXRegion, quad.y1, quad.x2, newYRegion, depth);
+		m_quads[first + SW_QUADRANT] = makeQuadrant(q, quad.x1, newYRegion, newXRegion, quad.y2, depth);
+		m_quads[first + SE_QUADRANT] = makeQuadrant(q, newXRegion, newYRegion, quad.x2, quad.y2, depth);
+		quad.firstChild = first; //tree is divided to quadrants, it's no longer a leaf node.
+		touch(q);
+		std::fill(m_dirty.begin() + first, m_dirty.begin() + first + 4, uint8_t(1)); //records may be recycled, nothing published matches them.
+		std::fill(m_mergePending.begin() + first, m_mergePending.begin() + first + 4, uint8_t(0));
+		pushWatches(q);
+
+		reArrangeNodes(q);
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			if (needsSplit(first + quadrant)) {
+				subdivide(first + quadrant);
+			}
+		}
+	}
+
+	/* Pushes nodes currently located on @q to the appropriate subtrees. (treats @q as the root)
+	* called after subtrees are generated, blocks of @q are given back to the pool.
+	* Quadrants are classified a chunk at a time with QuadSimd, then the nodes are moved.
+	* NOTE: this funct uses move semantics to prevent unnecessary copies.
+	*/
+	void reArrangeNodes(int q)
+	{
+		const Quadrant quad = m_quads[q];
+		QUADTREE_COUNT(REARRANGED_NODES, quad.size);
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		uint8_t quadrants[QuadSimd::CHUNK];
+		forEachBlock(q, [&](int base, int count) {
+			for (int offset = base; offset < base + count; offset += QuadSimd::CHUNK) {
+				int chunk = std::min<int>(QuadSimd::CHUNK, base + count - offset);
+				QuadSimd::classifyQuadrants(&m_xs[offset], &m_ys[offset], chunk, xMid, yMid, quadrants);
+				for (int i = 0; i < chunk; ++i) {
+					int child = quad.firstChild + quadrants[i];
+					appendNode(child, QNode<T>(std::move(m_points[offset + i])), m_slotHandle[offset + i]);
+					m_quads[child].currentBucketSize++;
+				}
+			}
+		});
+		for (int block = quad.firstBlock; block >= 0;) {
+			int next = m_blockNext[block];
+			freeBlock(block);
+			block = next;
+		}
+		m_quads[q].firstBlock = m_quads[q].lastBlock = -1;
+		m_quads[q].size = 0;
+	}
+
+	/* scratch arrays of bulkLoad(), [first, last) of every array belongs to the subtree being built. */
+	struct BulkBuffers
+	{
+		vector<float> xs, ys, tmpXs, tmpYs;
+		vector<uint32_t> index, tmpIndex;	//index of the node in the array passed to bulkLoad().
+		vector<uint8_t> quadrants;
+	};
+
+	/* quadrants built by one task of bulkLoad(), subtrees handed to other tasks are built into their own parts
+	* and spliced in once every task is done, see spliceParts().
+	*/
+	struct BulkPart
+	{
+		vector<Quadrant> quads;
+		vector<std::pair<int, std::unique_ptr<BulkPart>>> forks;	//record of quads whose subtree is built in the other part.
+	};
+
+	/* Runs @fn(first, last) over [0, @count) in ranges of @grain on @pool and waits for them, on the calling thread if @pool is nullptr. */
+	template<class Fn>
+	static void parallelFor(ThreadPool* pool, size_t count, size_t grain, Fn fn)
+	{
+		if (pool == nullptr || count <= grain) {
+			fn(size_t(0), count);
+			return;
+		}
+		for (size_t first = 0; first < count; first += grain) {
+			size_t last = std::min(count, first + grain);
+			pool->submit([fn, first, last] { fn(first, last); });
+		}
+		pool->wait();
+	}
+
+	/* bulkLoad() on @pool, serial if @pool is nullptr.
+	* 1) coordinates and the index of every node are partitioned into quadrant order, every leaf ends up as a range of buffers.index.
+	*    subtrees built by other tasks use their own quadrant vectors, they are spliced into the pool once they're done.
+	* 2) every leaf gets consecutive bucket blocks, duplicates are counted first, so each leaf knows where its nodes go
+	*    and the nodes themselves are copied straight into their buckets, in parallel.
+	*/
+	void bulkLoadHelper(const QNode<T>* nodes, size_t count, ThreadPool* pool)
+	{
+		QUADTREE_TIME(BULK_LOAD_OPERATION);
+		if (nodes == nullptr || count == 0) {
+			return;
+		}
+		if (m_quads[0].currentBucketSize != 0 || m_quads[0].firstChild >= 0) {
+			for (size_t i = 0; i < count; ++i) {
+				insertHelper(nodes[i]);
+			}
+			return;
+		}
+
+		BulkBuffers buffers;
+		buffers.xs.resize(count);
+		buffers.ys.resize(count);
+		buffers.index.resize(count);
+		buffers.tmpXs.resize(count);
+		buffers.tmpYs.resize(count);
+		buffers.tmpIndex.resize(count);
+		buffers.quadrants.resize(count);
+		parallelFor(pool, count, BULK_LOAD_PARALLEL_CUTOFF * 4, [&buffers, nodes](size_t first, size_t last) {
+			for (size_t i = first; i < last; ++i) {
+				buffers.xs[i] = nodes[i].x;
+				buffers.ys[i] = nodes[i].y;
+				buffers.index[i] = uint32_t(i);
+			}
+		});
+		BulkPart root;
+		root.quads.push_back(m_quads[0]);
+		buildSubtree(root, 0, buffers, nodes, 0, count, pool);
+		if (pool != nullptr) {
+			pool->wait();
+		}
+		spliceParts(root);
+
+		//tree is empty, so every quadrant record and every block is free.
+		m_quads.swap(root.quads);
+		m_quadTop = int(m_quads.size());
+		m_freeQuads = -1;
+		m_dirty.assign(m_quads.size(), 1);
+		m_mergePending.assign(m_quads.size(), 0);
+		m_watches.resizeQuads(m_quads.size());
+		fillBuckets(nodes, buffers, pool);
+		for (int q = m_quadTop - 1; q >= 0; --q) {
+			Quadrant& quad = m_quads[q];
+			if (quad.firstChild >= 0) {
+				quad.currentBucketSize = 0;
+				for (int quadrant = 0; quadrant < 4; ++quadrant) {
+					quad.currentBucketSize += m_quads[quad.firstChild + quadrant].currentBucketSize;
+				}
+			}
+		}
+		if (m_indexed) {
+			rebuildPointIndex();
+		}
+		if (m_watches.size() > 0) {
+			//the tree was a single leaf, so every watch is attached to the root.
+			pushWatches(0);
+			forEachWatch([this](int id) {
+				forEachWatched(0, id, [this, id](const QNode<T>& node) { m_watches.callback(id)(node, WATCH_ENTER); });
+			});
+		}
+	}
+
+	/* Recursive part of bulkLoad(), builds @part.quads[q] from [first, last) of @buffers.
+	* Ranges under the bucket capacity (or that can't be split, see needsSplit()) become leaves, sorted by x,y then by index, so the first of duplicates comes first. Until the buckets are filled,
+	* a leaf keeps the start of its range in firstBlock and the length of the range in size.
+	* Anything else is classified with QuadSimd and scattered into NW, NE, SW, SE order, the same order subdivide() creates the subtrees in.
+	* With a @pool, subtrees of large ranges are built by their own tasks into their own parts.
+	*/
+	void buildSubtree(BulkPart& part, int q, BulkBuffers& buffers, const QNode<T>* nodes, size_t first, size_t last, ThreadPool* pool) const
+	{
+		vector<Quadrant>& quads = part.quads;
+		size_t count = last - first;
+		Quadrant quad = quads[q];
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		//same rules as needsSplit().
+		bool isLeaf = count <= size_t(bucketCapacity()) || quad.depth >= maxDepth()
+			|| !(quad.x1 < xMid && xMid < quad.x2 && quad.y1 < yMid && yMid < quad.y2);
+		if (!isLeaf) {
+			//identical points, or points outside of the quadrant that all fall in the same subtree, can never be separated.
+			bool identical = true, stuck = true;
+			int corner = (buffers.xs[first] >= xMid) | ((buffers.ys[first] >= yMid) << 1);
+			for (size_t i = first; i < last && (identical || stuck); ++i) {
+				float x = buffers.xs[i], y = buffers.ys[i];
+				identical = identical && x == buffers.xs[first] && y == buffers.ys[first];
+				stuck = stuck && !(x >= quad.x1 && x <= quad.x2 && y >= quad.y1 && y <= quad.y2) && ((x >= xMid) | ((y >= yMid) << 1)) == corner;
+			}
+			isLeaf = identical || stuck;
+		}
+		if (isLeaf) {
+			std::sort(buffers.index.begin() + first, buffers.index.begin() + last, [nodes](uint32_t a, uint32_t b) {
+				return nodes[a].x < nodes[b].x || (nodes[a].x == nodes[b].x && (nodes[a].y < nodes[b].y || (nodes[a].y == nodes[b].y && a < b)));
+			});
+			quads[q].firstBlock = int(first);
+			quads[q].size = int(count);
+			return;
+		}
+
+		QuadSimd::classifyQuadrants(&buffers.xs[first], &buffers.ys[first], int(count), xMid, yMid, &buffers.quadrants[first]);
+		size_t counts[4] = { 0, 0, 0, 0 };
+		for (size_t i = first; i < last; ++i) {
+			counts[buffers.quadrants[i]]++;
+		}
+		size_t bounds[5] = { first, first + counts[0], first + counts[0] + counts[1], last - counts[3], last };
+		size_t cursor[4] = { bounds[0], bounds[1], bounds[2], bounds[3] };
+		for (size_t i = first; i < last; ++i) {
+			size_t to = cursor[buffers.quadrants[i]]++;
+			buffers.tmpXs[to] = buffers.xs[i];
+			buffers.tmpYs[to] = buffers.ys[i];
+			buffers.tmpIndex[to] = buffers.index[i];
+		}
+		std::copy(buffers.tmpXs.begin() + first, buffers.tmpXs.begin() + last, buffers.xs.begin() + first);
+		std::copy(buffers.tmpYs.begin() + first, buffers.tmpYs.begin() + last, buffers.ys.begin() + first);
+		std::copy(buffers.tmpIndex.begin() + first, buffers.tmpIndex.begin() + last, buffers.index.begin() + first);
+
+		int firstChild = int(quads.size());
+		quads[q].firstChild = firstChild;
+		quads.push_back(makeQuadrant(q, quad.x1, quad.y1, xMid, yMid, quad.depth + 1));
+		quads.push_back(makeQuadrant(q, xMid, quad.y1, quad.x2, yMid, quad.depth + 1));
+		quads.push_back(makeQuadrant(q, quad.x1, yMid, xMid, quad.y2, quad.depth + 1));
+		quads.push_back(makeQuadrant(q, xMid, yMid, quad.x2, quad.y2, quad.depth + 1));
+
+		if (pool == nullptr || count < BULK_LOAD_PARALLEL_CUTOFF) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				buildSubtree(part, firstChild + quadrant, buffers, nodes, bounds[quadrant], bounds[quadrant + 1], nullptr);
+			}
+			return;
+		}
+		for (int quadrant = 0; quadrant < 4; ++quadrant) {
+			std::unique_ptr<BulkPart> fork(new BulkPart());
+			fork->quads.push_back(quads[firstChild + quadrant]);
+			fork->quads[0].parent = -1;
+			BulkPart* subtree = fork.get();
+			size_t begin = bounds[quadrant];
+			size_t end = bounds[quadrant + 1];
+			part.forks.push_back(std::make_pair(firstChild + quadrant, std::move(fork)));
+			pool->submit([this, subtree, &buffers, nodes, begin, end, pool] { buildSubtree(*subtree, 0, buffers, nodes, begin, end, pool); });
+		}
+	}
+
+	/* splices the parts forked from @part (and the parts forked from them) into @part.quads.
+	* record 0 of a fork is the child that's already in @part.quads, the rest are appended after, so children still come after their parents.
+	*/
+	static void spliceParts(BulkPart& part)
+	{
+		vector<Quadrant>& quads = part.quads;
+		for (std::pair<int, std::unique_ptr<BulkPart>>& fork : part.forks) {
+			spliceParts(*fork.second);
+			const vector<Quadrant>& subtree = fork.second->quads;
+			int at = fork.first;
+			int offset = int(quads.size()) - 1;
+			auto remap = [&](int index) { return index <= 0 ? at : index + offset; };
+			for (size_t i = 0; i < subtree.size(); ++i) {
+				Quadrant record = subtree[i];
+				record.parent = (i == 0) ? quads[at].parent : remap(record.parent);
+				if (record.firstChild >= 0) {
+					record.firstChild = remap(record.firstChild);
+				}
+				if (i == 0) {
+					quads[at] = record;
+				}
+				else {
+					quads.push_back(record);
+				}
+			}
+		}
+		part.forks.clear();
+	}
+
+	/* Last step of bulkLoad(): leaves still hold their range of buffers.index, moves the nodes into their buckets.
+	* Leaf ranges are sorted by x, y so duplicates are next to each other, only the first one is kept and the handles of the others are freed.
+	* Unique nodes are counted first, then every leaf gets a run of consecutive blocks and fills it on its own.
+	*/
+	void fillBuckets(const QNode<T>* nodes, const BulkBuffers& buffers, ThreadPool* pool)
+	{
+		vector<int> leaves;
+		vector<int> ranges;	//start of the range of each leaf in buffers.index.
+		for (int q = 0; q < m_quadTop; ++q) {
+			Quadrant& quad = m_quads[q];
+			if (quad.firstChild >= 0) {
+				continue;
+			}
+			if (quad.size > 0) {
+				leaves.push_back(q);
+				ranges.push_back(quad.firstBlock);
+			}
+			else {
+				quad.firstBlock = quad.lastBlock = -1;
+			}
+		}
+		vector<int> unique(leaves.size());
+		auto isDuplicate = [nodes, &buffers](int i, int begin) {
+			return i != begin && nodes[buffers.index[i]].x == nodes[buffers.index[i - 1]].x && nodes[buffers.index[i]].y == nodes[buffers.index[i - 1]].y;
+		};
+		size_t grain = std::max<size_t>(1, BULK_LOAD_PARALLEL_CUTOFF / std::max(1, bucketCapacity()));
+		parallelFor(pool, leaves.size(), grain, [&](size_t first, size_t last) {
+			for (size_t k = first; k < last; ++k) {
+				int begin = ranges[k];
+				int end = begin + m_quads[leaves[k]].size;
+				for (int i = begin; i < end; ++i) {
+					unique[k] += !isDuplicate(i, begin);
+				}
+			}
+		});
+
+		m_blockTop = 0;
+		m_freeBlocks = -1;
+		for (size_t k = 0; k < leaves.size(); ++k) {
+			Quadrant& quad = m_quads[leaves[k]];
+			int blocks = (unique[k] + blockSize() - 1) / blockSize();
+			quad.firstBlock = m_blockTop;
+			quad.lastBlock = m_blockTop + blocks - 1;
+			quad.size = quad.currentBucketSize = unique[k];
+			m_blockTop += blocks;
+		}
+		if (size_t(m_blockTop) > m_blockNext.size()) {
+			size_t slots = size_t(m_blockTop) * blockSize();
+			m_points.resize(slots, QNode<T>(0, 0));
+			m_xs.resize(slots);
+			m_ys.resize(slots);
+			m_slotHandle.resize(slots);
+			m_blockNext.resize(m_blockTop);
+			m_blockOwner.resize(m_blockTop);
+		}
+		m_handleSlot.assign(buffers.index.size(), -1);
+
+		parallelFor(pool, leaves.size(), grain, [&](size_t first, size_t last) {
+			for (size_t k = first; k < last; ++k) {
+				int q = leaves[k];
+				const Quadrant& quad = m_quads[q];
+				for (int block = quad.firstBlock; block <= quad.lastBlock; ++block) {
+					m_blockNext[block] = block < quad.lastBlock ? block + 1 : -1;
+					m_blockOwner[block] = q;
+				}
+				int begin = ranges[k];
+				int slot = quad.firstBlock * blockSize();
+				for (int i = begin, remaining = quad.size; remaining > 0; ++i) {
+					if (isDuplicate(i, begin)) {
+						continue;
+					}
+					const QNode<T>& node = nodes[buffers.index[i]];
+					m_xs[slot] = node.x;
+					m_ys[slot] = node.y;
+					m_points[slot] = node;
+					m_slotHandle[slot] = Handle(buffers.index[i]);
+					m_handleSlot[buffers.index[i]] = slot;
+					slot++;
+					remaining--;
+				}
+			}
+		});
+		m_freeHandles.clear();
+		for (size_t i = 0; i < m_handleSlot.size(); ++i) {
+			if (m_handleSlot[i] < 0) {
+				m_freeHandles.push_back(Handle(i));
+			}
+		}
+	}
+
+	/*
+	1 (0 << 1)		1 | 0 = 1
+	0 (1 << 1)		0 | 2 = 2
+	1 (1  << 1)		1 | 2 = 3
+	0 (0 << 1)		0 | 0 = 0
+	*/
+
+	/*
+	Given node, check which quadrant of @quad it would fall into.
+	optimized so that it only does very few instructions to get quadrant
+	to classify many nodes at once use QuadSimd::classifyQuadrants, which does 4 or 8 of them per compare.
+	DOESNT CHECK FOR NODES FALLS OUTSIDE QuadTree (which should never happen)
+	if you want to check if a node is outside of quadtree, check it BEFORE calling this function.
+	*/
+	static inline int checkQuadrant(const Quadrant& quad, const QNode<T> &node)
+	{
+		return checkQuadrant(quad, node.x, node.y);
+	}
+
+	/* return the quadrant of where x,y would be in given @quad. */
+	static inline int checkQuadrant(const Quadrant& quad, float x, float y)
+	{
+		float xMid = quad.x1 + (quad.x2 - quad.x1) / 2.0f;
+		float yMid = quad.y1 + (quad.y2 - quad.y1) / 2.0f;
+		int res = (x >= xMid) | ((y >= yMid) << 1);
+		return res;
+	}
+
+	//Member variables, only read through bucketCapacity(), maxDepth() and blockSize().
+	int m_bucketCapacity;	//num of nodes per tree before it splitting to subtrees.
+	int m_maxDepth;			//max time tree can split.
+	int m_blockSize;		//num of nodes per bucket block.
+	int m_mergeThreshold;	//subtrees holding this many nodes or less are merged, see setMergeThreshold().
+	bool m_deferMerges;		//merges wait for compact(), see deferMerges().
+
+	static const size_t BULK_LOAD_PARALLEL_CUTOFF = 1 << 14; //ranges smaller than this are built on the current thread.
+	static const size_t BATCH_PARALLEL_CUTOFF = 1 << 14;	//min num of moves commit() hands to a thread.
+	static const int JOIN_PARALLEL_CUTOFF = 1 << 12;		//subtrees (and pairs of subtrees) with fewer nodes are joined in a single task.
+	static const int TRAVERSAL_PARALLEL_CUTOFF = 1 << 14;	//subtrees with fewer nodes are visited by forEach() in a single task.
+	static constexpr float NAN_COORD = std::numeric_limits<float>::quiet_NaN();	//coordinate no watch contains, see notifyQuadrant().
+
+	//represents quadrants
+	enum quadrants { NW_QUADRANT = 0, NE_QUADRANT = 1, SW_QUADRANT = 2, SE_QUADRANT = 3 };
+
+	/* quadrant pool, m_quads[0] is the root. records past m_quadTop are unused but kept for reuse after clear(). */
+	vector<Quadrant> m_quads;
+	int m_quadTop;
+	int m_freeQuads;			//first record of the first free group of 4 quadrants, -1 if none.
+
+	/* node pool, block b holds indices [b * blockSize(), (b + 1) * blockSize()) of m_xs, m_ys and m_points.
+	* m_blockNext chains the blocks of a bucket.
+	*/
+	vector<float> m_xs;			//x-coordinates, scanned by queries.
+	vector<float> m_ys;			//y-coordinates, scanned by queries.
+	vector<QNode<T>> m_points;	//payloads, what queries hand back.
+	vector<Handle> m_slotHandle;	//handle of the node in each slot.
+	vector<int> m_blockNext;
+	vector<int> m_blockOwner;	//leaf quadrant each block belongs to.
+	int m_blockTop;
+	int m_freeBlocks;			//first free block, -1 if none.
+
+	/* handle table, handle -> pool index of the node, -1 for handles that aren't in use. */
+	vector<int> m_handleSlot;
+	vector<Handle> m_freeHandles;
+
+	/* moves queued by moveAll(), and scratch arrays of commit() kept around for the next batch. */
+	vector<Move> m_batch;
+	vector<int> m_batchTarget;		//destination leaf of each move, only filled for batches split between threads.
+	vector<int> m_batchSources;		//leaves that lost a node.
+	vector<int> m_batchTargets;		//leaves that went over capacity.
+
+	/* Snapshots, see publish() */
+	vector<uint8_t> m_dirty;		//1 if the quadrant at the same index in m_quads changed since the last publish().
+
+	/* Deferred merges, see compact() */
+	vector<uint8_t> m_mergePending;	//1 if the quadrant at the same index in m_quads (or one of its subtrees) lost nodes since the last compact().
+	std::shared_ptr<const QuadTreeSnapshot<T>> m_published;	//only accessed through atomic_load/atomic_store.
+
+	/* region watches and the chains of every quadrant record, see watch() */
+	QuadWatchList<WatchCallback> m_watches;
+
+	/* coordinates -> handle, see usePointIndex() */
+	QuadPointIndex m_pointIndex;
+	bool m_indexed;
+
+#ifdef QUADTREE_INSTRUMENTATION
+	/* see counters() and setTimingHook(), counters are bumped by const searches too so they're atomic. */
+	mutable std::atomic<uint64_t> m_counters[QuadTreeCounters::COUNT];
+	QuadTreeTimingHook m_timingHook;
+#endif
 
 };
 
-template <class T> int QuadTree<T>::m_bucketCapacity = 0;
-template <class T> int QuadTree<T>::m_maxDepth = 0;
\ No newline at end of file
+template <class T, int Capacity, int MaxDepth> const typename QuadTree<T, Capacity, MaxDepth>::Handle QuadTree<T, Capacity, MaxDepth>::INVALID_HANDLE;
@@ -0,0 +1,15 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Picks the QuadTree implementation at compile time, both backends share the same insert/find/remove/update/query API.
+* Define QUADTREE_LINEAR_BACKEND to use the pointer-free, Morton ordered LinearQuadTree, QuadTree is used otherwise.
+*/
+
+#pragma once
+
+#ifdef QUADTREE_LINEAR_BACKEND
+#include "LinearQuadtree.hpp"
+template<class T> using QuadTreeBackend = LinearQuadTree<T>;
+#else
+#include "Quadtree.hpp"
+template<class T> using QuadTreeBackend = QuadTree<T>;
+#endif
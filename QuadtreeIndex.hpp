@@ -0,0 +1,166 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Open addressing hash table from point coordinates to QuadTree handles, see QuadTree::usePointIndex().
+*
+* Keys are the bit patterns of x and y packed in 64 bits, values are handles, every entry is 12 bytes in one flat array.
+* Linear probing with the table kept at most half full, so a lookup is one hashed probe and usually a single cache line.
+* Deletes shift the following entries of the cluster back instead of leaving tombstones, so lookups never slow down over time.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class QuadPointIndex
+{
+public:
+	QuadPointIndex() : m_size(0), m_mask(0) {}
+
+	/* handle stored for x,y, -1 if there is none. */
+	int find(float x, float y) const
+	{
+		if (m_size == 0) {
+			return -1;
+		}
+		uint64_t key = makeKey(x, y);
+		for (size_t i = slotOf(key); ; i = (i + 1) & m_mask) {
+			const Entry& entry = m_entries[i];
+			if (entry.value < 0) {
+				return -1;
+			}
+			if (entry.key == key) {
+				return entry.value;
+			}
+		}
+	}
+
+	/* maps x,y to @handle, x,y must not be in the index yet. */
+	void insert(float x, float y, int handle)
+	{
+		if ((m_size + 1) * 2 > m_entries.size()) {
+			rehash(m_entries.empty() ? MIN_SLOTS : m_entries.size() * 2);
+		}
+		place(makeKey(x, y), handle);
+		m_size++;
+	}
+
+	/* removes x,y, nothing happens if it isn't there. */
+	void erase(float x, float y)
+	{
+		if (m_size == 0) {
+			return;
+		}
+		uint64_t key = makeKey(x, y);
+		size_t i = slotOf(key);
+		while (m_entries[i].key != key) {
+			if (m_entries[i].value < 0) {
+				return;
+			}
+			i = (i + 1) & m_mask;
+		}
+		//backward shift: pull back every following entry of the cluster that may sit in the hole.
+		for (size_t next = (i + 1) & m_mask; m_entries[next].value >= 0; next = (next + 1) & m_mask) {
+			size_t home = slotOf(m_entries[next].key);
+			if (((next - home) & m_mask) >= ((next - i) & m_mask)) {
+				m_entries[i] = m_entries[next];
+				i = next;
+			}
+		}
+		m_entries[i].value = -1;
+		m_size--;
+	}
+
+	/* makes room for @count entries without rehashing. */
+	void reserve(size_t count)
+	{
+		size_t slots = MIN_SLOTS;
+		while (slots < count * 2) {
+			slots *= 2;
+		}
+		if (slots > m_entries.size()) {
+			rehash(slots);
+		}
+	}
+
+	/* removes every entry, the table is kept. */
+	void clear()
+	{
+		for (Entry& entry : m_entries) {
+			entry.value = -1;
+		}
+		m_size = 0;
+	}
+
+	/* removes every entry and gives the table back. */
+	void release()
+	{
+		std::vector<Entry>().swap(m_entries);
+		m_size = 0;
+		m_mask = 0;
+	}
+
+	inline size_t size() const { return m_size; }
+	inline size_t bytesUsed() const { return m_entries.capacity() * sizeof(Entry); }
+
+private:
+	static const size_t MIN_SLOTS = 16;
+
+#pragma pack(push, 4)
+	struct Entry
+	{
+		uint64_t key;
+		int32_t value;	//-1 for empty slots.
+	};
+#pragma pack(pop)
+
+	/* -0 and 0 are the same coordinate for the tree (it compares with ==), so they get the same key. */
+	static inline uint64_t makeKey(float x, float y)
+	{
+		x += 0.0f;
+		y += 0.0f;
+		uint32_t xBits, yBits;
+		std::memcpy(&xBits, &x, sizeof(xBits));
+		std::memcpy(&yBits, &y, sizeof(yBits));
+		return (uint64_t(xBits) << 32) | yBits;
+	}
+
+	/* home slot of @key, finalizer of splitmix64 so nearby coordinates spread over the table. */
+	inline size_t slotOf(uint64_t key) const
+	{
+		key ^= key >> 30;
+		key *= 0xbf58476d1ce4e5b9ULL;
+		key ^= key >> 27;
+		key *= 0x94d049bb133111ebULL;
+		key ^= key >> 31;
+		return size_t(key) & m_mask;
+	}
+
+	void place(uint64_t key, int value)
+	{
+		size_t i = slotOf(key);
+		while (m_entries[i].value >= 0) {
+			i = (i + 1) & m_mask;
+		}
+		m_entries[i].key = key;
+		m_entries[i].value = value;
+	}
+
+	void rehash(size_t slots)
+	{
+		std::vector<Entry> old;
+		old.swap(m_entries);
+		Entry empty = { 0, -1 };
+		m_entries.assign(slots, empty);
+		m_mask = slots - 1;
+		for (const Entry& entry : old) {
+			if (entry.value >= 0) {
+				place(entry.key, entry.value);
+			}
+		}
+	}
+
+	std::vector<Entry> m_entries;	//power of 2 slots.
+	size_t m_size;
+	size_t m_mask;
+};
@@ -0,0 +1,89 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Ray used by the raycast() and segmentQuery() of QuadTree and LooseQuadTree.
+*
+* Points have no extent, so a ray hits a point if it passes within @radius of it (the point is a disc).
+* Quadrants and boxes are tested with the slab method, boxes are grown by @radius on every side.
+* Distances along the ray are measured from its origin in the units of the tree, the direction is normalized.
+*/
+
+#pragma once
+#include <cmath>
+#include <algorithm>
+
+struct QuadRay
+{
+	float ox, oy;		//origin
+	float dx, dy;		//unit direction
+	float radius;
+	int order;			//XOR'ed with 0..3 gives the subtrees of a quadrant (NW, NE, SW, SE) front to back.
+
+	/* false if dx,dy has no length. */
+	static bool make(float ox, float oy, float dx, float dy, float radius, QuadRay& ray)
+	{
+		float length = std::sqrt(dx * dx + dy * dy);
+		if (!(length > 0.0f)) {
+			return false;
+		}
+		ray.ox = ox;
+		ray.oy = oy;
+		ray.dx = dx / length;
+		ray.dy = dy / length;
+		ray.radius = std::max(radius, 0.0f);
+		//a ray going left enters the east half first, going up the south half first, see QuadTree::checkQuadrant.
+		ray.order = (ray.dx < 0.0f ? 1 : 0) | (ray.dy < 0.0f ? 2 : 0);
+		return true;
+	}
+
+	/* Distance along the ray where it enters the box x1,y1 - x2,y2 grown by radius, if it does before @maxT.
+	* A ray starting inside the box enters it at 0.
+	*/
+	inline bool entersBox(float x1, float y1, float x2, float y2, float maxT, float& t) const
+	{
+		float tEnter = 0.0f, tExit = maxT;
+		if (!slab(ox, dx, x1 - radius, x2 + radius, tEnter, tExit) || !slab(oy, dy, y1 - radius, y2 + radius, tEnter, tExit)) {
+			return false;
+		}
+		t = tEnter;
+		return true;
+	}
+
+	/* Distance along the ray where it enters the disc of radius around px,py. false if it misses it or the disc is behind the origin. */
+	inline bool hitsPoint(float px, float py, float& t) const
+	{
+		float rx = px - ox, ry = py - oy;
+		float along = rx * dx + ry * dy;
+		float across = rx * dy - ry * dx;
+		float slackSq = radius * radius - across * across;
+		if (slackSq < 0.0f) {
+			return false;
+		}
+		float enter = along - std::sqrt(slackSq);
+		if (enter < 0.0f) {
+			//origin inside the disc is a hit at 0, a disc entirely behind the origin isn't.
+			if (rx * rx + ry * ry > radius * radius) {
+				return false;
+			}
+			enter = 0.0f;
+		}
+		t = enter;
+		return true;
+	}
+
+private:
+	/* clips [tEnter, tExit] to the part of the ray between lo and hi on one axis. */
+	static inline bool slab(float origin, float dir, float lo, float hi, float& tEnter, float& tExit)
+	{
+		if (dir == 0.0f) {
+			return origin >= lo && origin <= hi;
+		}
+		float inv = 1.0f / dir;
+		float t1 = (lo - origin) * inv, t2 = (hi - origin) * inv;
+		if (t1 > t2) {
+			std::swap(t1, t2);
+		}
+		tEnter = std::max(tEnter, t1);
+		tExit = std::min(tExit, t2);
+		return tEnter <= tExit;
+	}
+};
@@ -0,0 +1,171 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Batched kernels used by QuadTree on its structure-of-arrays buckets:
+* quadrant classification and rectangle/radius filtering of many points at once.
+*
+* The instruction set is picked at compile time: AVX (8 points per compare) when the compiler targets it (-mavx2 or /arch:AVX2),
+* SSE2 (4 points per compare, always there on x86-64) otherwise, and plain scalar loops on every other platform.
+* Define QUADTREE_NO_SIMD to force the scalar loops. All paths return exactly what the scalar loops do.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+#if !defined(QUADTREE_NO_SIMD) && (defined(__AVX2__) || defined(__AVX__))
+#define QUADTREE_SIMD_AVX
+#define QUADTREE_SIMD_SSE2
+#include <immintrin.h>
+#elif !defined(QUADTREE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define QUADTREE_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+class QuadSimd
+{
+public:
+	enum { CHUNK = 64 }; //callers filter at most CHUNK points per call, so hit buffers can live on the stack.
+
+	/* out[i] = quadrant of xs[i], ys[i] around xMid, yMid, same encoding as QuadTree::checkQuadrant:
+	* (x >= xMid) | (y >= yMid) << 1, so NW = 0, NE = 1, SW = 2, SE = 3.
+	*/
+	static inline void classifyQuadrants(const float* xs, const float* ys, int count, float xMid, float yMid, uint8_t* out)
+	{
+		int i = 0;
+#ifdef QUADTREE_SIMD_AVX
+		const __m256 xMid8 = _mm256_set1_ps(xMid);
+		const __m256 yMid8 = _mm256_set1_ps(yMid);
+		for (; i + 8 <= count; i += 8) {
+			int xBits = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(xs + i), xMid8, _CMP_GE_OQ));
+			int yBits = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(ys + i), yMid8, _CMP_GE_OQ));
+			storeQuadrants(xBits & 15, yBits & 15, out + i);
+			storeQuadrants(xBits >> 4, yBits >> 4, out + i + 4);
+		}
+#endif
+#ifdef QUADTREE_SIMD_SSE2
+		const __m128 xMid4 = _mm_set1_ps(xMid);
+		const __m128 yMid4 = _mm_set1_ps(yMid);
+		for (; i + 4 <= count; i += 4) {
+			int xBits = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(xs + i), xMid4));
+			int yBits = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(ys + i), yMid4));
+			storeQuadrants(xBits, yBits, out + i);
+		}
+#endif
+		for (; i < count; ++i) {
+			out[i] = uint8_t((xs[i] >= xMid) | ((ys[i] >= yMid) << 1));
+		}
+	}
+
+	/* writes the index of every point inside the rectangle x1,y1 - x2,y2 (inclusive) to @out, returns the num of hits.
+	* @count must be at most CHUNK.
+	*/
+	static inline int filterRect(const float* xs, const float* ys, int count, float x1, float y1, float x2, float y2, int* out)
+	{
+		int hits = 0;
+		int i = 0;
+#ifdef QUADTREE_SIMD_AVX
+		const __m256 x1s = _mm256_set1_ps(x1), y1s = _mm256_set1_ps(y1);
+		const __m256 x2s = _mm256_set1_ps(x2), y2s = _mm256_set1_ps(y2);
+		for (; i + 8 <= count; i += 8) {
+			__m256 x = _mm256_loadu_ps(xs + i);
+			__m256 y = _mm256_loadu_ps(ys + i);
+			__m256 inX = _mm256_and_ps(_mm256_cmp_ps(x, x1s, _CMP_GE_OQ), _mm256_cmp_ps(x, x2s, _CMP_LE_OQ));
+			__m256 inY = _mm256_and_ps(_mm256_cmp_ps(y, y1s, _CMP_GE_OQ), _mm256_cmp_ps(y, y2s, _CMP_LE_OQ));
+			hits = appendHits(_mm256_movemask_ps(_mm256_and_ps(inX, inY)), i, out, hits);
+		}
+#endif
+#ifdef QUADTREE_SIMD_SSE2
+		const __m128 x1q = _mm_set1_ps(x1), y1q = _mm_set1_ps(y1);
+		const __m128 x2q = _mm_set1_ps(x2), y2q = _mm_set1_ps(y2);
+		for (; i + 4 <= count; i += 4) {
+			__m128 x = _mm_loadu_ps(xs + i);
+			__m128 y = _mm_loadu_ps(ys + i);
+			__m128 inX = _mm_and_ps(_mm_cmpge_ps(x, x1q), _mm_cmple_ps(x, x2q));
+			__m128 inY = _mm_and_ps(_mm_cmpge_ps(y, y1q), _mm_cmple_ps(y, y2q));
+			hits = appendHits(_mm_movemask_ps(_mm_and_ps(inX, inY)), i, out, hits);
+		}
+#endif
+		for (; i < count; ++i) {
+			if (x1 <= xs[i] && xs[i] <= x2 && y1 <= ys[i] && ys[i] <= y2) {
+				out[hits++] = i;
+			}
+		}
+		return hits;
+	}
+
+	/* writes the index of every point within sqrt(@radiusSq) of cx,cy (inclusive) to @out, returns the num of hits.
+	* @count must be at most CHUNK.
+	*/
+	static inline int filterCircle(const float* xs, const float* ys, int count, float cx, float cy, float radiusSq, int* out)
+	{
+		int hits = 0;
+		int i = 0;
+#ifdef QUADTREE_SIMD_AVX
+		const __m256 cxs = _mm256_set1_ps(cx), cys = _mm256_set1_ps(cy), r8 = _mm256_set1_ps(radiusSq);
+		for (; i + 8 <= count; i += 8) {
+			__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), cxs);
+			__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), cys);
+			__m256 distSq = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+			hits = appendHits(_mm256_movemask_ps(_mm256_cmp_ps(distSq, r8, _CMP_LE_OQ)), i, out, hits);
+		}
+#endif
+#ifdef QUADTREE_SIMD_SSE2
+		const __m128 cxq = _mm_set1_ps(cx), cyq = _mm_set1_ps(cy), r4 = _mm_set1_ps(radiusSq);
+		for (; i + 4 <= count; i += 4) {
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), cxq);
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), cyq);
+			__m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			hits = appendHits(_mm_movemask_ps(_mm_cmple_ps(distSq, r4)), i, out, hits);
+		}
+#endif
+		for (; i < count; ++i) {
+			float dx = xs[i] - cx;
+			float dy = ys[i] - cy;
+			if (dx * dx + dy * dy <= radiusSq) {
+				out[hits++] = i;
+			}
+		}
+		return hits;
+	}
+
+private:
+
+	static inline int countTrailingZeros(unsigned mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return int(index);
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	/* appends offset + bit for every bit set in @mask, lowest first. */
+	static inline int appendHits(int mask, int offset, int* out, int hits)
+	{
+		unsigned bits = unsigned(mask);
+		while (bits != 0) {
+			out[hits++] = offset + countTrailingZeros(bits);
+			bits &= bits - 1;
+		}
+		return hits;
+	}
+
+#ifdef QUADTREE_SIMD_SSE2
+	/* turns 4 compare bits of x and y into 4 quadrant bytes, spread[n] has bit j of n in byte j (x86 is little endian). */
+	static inline void storeQuadrants(int xBits, int yBits, uint8_t* out)
+	{
+		static const uint32_t spread[16] = {
+			0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+			0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101
+		};
+		uint32_t quadrants = spread[xBits] | (spread[yBits] << 1);
+		std::memcpy(out, &quadrants, sizeof(quadrants));
+	}
+#endif
+};
@@ -0,0 +1,137 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Immutable snapshot of a QuadTree, see QuadTree::publish() and QuadTree::snapshot().
+*
+* A snapshot is a tree of reference counted, read-only nodes. Publishing a new snapshot only copies the quadrants that were
+* modified since the previous one (and the path from them to the root), every other subtree is shared with the previous snapshot.
+* Readers hold a snapshot through a shared_ptr and query it without any locking while the writer keeps modifying the QuadTree,
+* a version (and the subtrees only it uses) is freed once the last reader holding it lets go of it.
+*/
+
+#pragma once
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "QNode.h"
+#include "QuadtreeSimd.hpp"
+
+template<class T, int Capacity, int MaxDepth> class QuadTree;
+
+template<class T>
+class QuadTreeSnapshot
+{
+public:
+	QuadTreeSnapshot(const QuadTreeSnapshot&) = delete;				//forbid copy constructor
+	QuadTreeSnapshot& operator=(QuadTreeSnapshot const&) = delete;	//forbid copy assignment operator
+
+	/* Calls @visitor(const QNode<T>&) for every node inside the rectangle x1,y1 - x2,y2 (inclusive), same as QuadTree::query(). */
+	template<class Visitor>
+	void query(float x1, float y1, float x2, float y2, Visitor&& visitor) const
+	{
+		queryHelper(*m_root, x1, y1, x2, y2, visitor);
+	}
+
+	/* same as above, but appends the nodes found to @out instead. */
+	void query(float x1, float y1, float x2, float y2, vector<const QNode<T>*>& out) const
+	{
+		query(x1, y1, x2, y2, [&out](const QNode<T>& node) { out.push_back(&node); });
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node within @radius of cx,cy (inclusive), same as QuadTree::queryCircle(). */
+	template<class Visitor>
+	void queryCircle(float cx, float cy, float radius, Visitor&& visitor) const
+	{
+		queryCircleHelper(*m_root, cx, cy, radius * radius, visitor);
+	}
+
+	/* same as above, but appends the nodes found to @out instead. */
+	void queryCircle(float cx, float cy, float radius, vector<const QNode<T>*>& out) const
+	{
+		queryCircle(cx, cy, radius, [&out](const QNode<T>& node) { out.push_back(&node); });
+	}
+
+	/* true if a node at @node's coordinates was in the tree when the snapshot was taken. */
+	bool find(const QNode<T>& node) const
+	{
+		bool found = false;
+		query(node.x, node.y, node.x, node.y, [&found](const QNode<T>&) { found = true; });
+		return found;
+	}
+
+	inline int size() const { return m_root->count; }
+
+	/* num of times the tree was published before this snapshot, increases by one with every publish(). */
+	inline size_t version() const { return m_version; }
+
+private:
+	template<class U, int C, int D> friend class QuadTree;
+
+	/* read-only copy of a quadrant, subtrees are shared between snapshots. leaves keep their nodes as structure-of-arrays like QuadTree. */
+	struct Node
+	{
+		float x1, y1, x2, y2;					//QuadTree::extent() of the quadrant, nodes outside of the tree are in the edge quadrants.
+		int count;								//num of nodes in this quadrant and all of its subtrees.
+		std::shared_ptr<const Node> children[4];	//NW, NE, SW, SE. empty for leaves.
+		vector<float> xs, ys;
+		vector<QNode<T>> points;
+	};
+
+	QuadTreeSnapshot(std::shared_ptr<const Node> root, size_t version) : m_root(std::move(root)), m_version(version) {}
+
+	static inline bool overlaps(const Node& node, float x1, float y1, float x2, float y2)
+	{
+		return x1 <= node.x2 && node.x1 <= x2 && y1 <= node.y2 && node.y1 <= y2;
+	}
+
+	static inline float minDistSq(const Node& node, float x, float y)
+	{
+		float dx = (x < node.x1) ? node.x1 - x : (x > node.x2 ? x - node.x2 : 0.0f);
+		float dy = (y < node.y1) ? node.y1 - y : (y > node.y2 ? y - node.y2 : 0.0f);
+		return dx * dx + dy * dy;
+	}
+
+	template<class Visitor>
+	static void queryHelper(const Node& node, float x1, float y1, float x2, float y2, Visitor& visitor)
+	{
+		if (node.children[0]) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				if (overlaps(*node.children[quadrant], x1, y1, x2, y2)) {
+					queryHelper(*node.children[quadrant], x1, y1, x2, y2, visitor);
+				}
+			}
+			return;
+		}
+		int hits[QuadSimd::CHUNK];
+		int count = int(node.points.size());
+		for (int offset = 0; offset < count; offset += QuadSimd::CHUNK) {
+			int found = QuadSimd::filterRect(&node.xs[offset], &node.ys[offset], std::min<int>(QuadSimd::CHUNK, count - offset), x1, y1, x2, y2, hits);
+			for (int i = 0; i < found; ++i) {
+				visitor(node.points[offset + hits[i]]);
+			}
+		}
+	}
+
+	template<class Visitor>
+	static void queryCircleHelper(const Node& node, float cx, float cy, float radiusSq, Visitor& visitor)
+	{
+		if (node.children[0]) {
+			for (int quadrant = 0; quadrant < 4; ++quadrant) {
+				if (minDistSq(*node.children[quadrant], cx, cy) <= radiusSq) {
+					queryCircleHelper(*node.children[quadrant], cx, cy, radiusSq, visitor);
+				}
+			}
+			return;
+		}
+		int hits[QuadSimd::CHUNK];
+		int count = int(node.points.size());
+		for (int offset = 0; offset < count; offset += QuadSimd::CHUNK) {
+			int found = QuadSimd::filterCircle(&node.xs[offset], &node.ys[offset], std::min<int>(QuadSimd::CHUNK, count - offset), cx, cy, radiusSq, hits);
+			for (int i = 0; i < found; ++i) {
+				visitor(node.points[offset + hits[i]]);
+			}
+		}
+	}
+
+	std::shared_ptr<const Node> m_root;
+	size_t m_version;
+};
@@ -0,0 +1,95 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Shape statistics and instrumentation of QuadTree, see QuadTree::stats(), QuadTree::counters() and QuadTree::setTimingHook().
+*
+* stats() is always available, it walks the quadrants once and allocates only the histograms.
+* Counters and timing hooks cost a few instructions on the hot paths, so they're compiled in only when QUADTREE_INSTRUMENTATION
+* is defined (the same way in every translation unit, it changes the layout of QuadTree). Without it counters() returns zeros
+* and hooks are never called, code using them builds either way.
+*/
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+/* shape of a tree at the time stats() is called */
+struct QuadTreeStats
+{
+	size_t nodes;				//num of nodes in the tree.
+	size_t quadrants;			//num of quadrants in use, leaves included.
+	size_t leaves;
+	size_t emptyLeaves;
+	int depth;					//depth of the deepest leaf, the root is at 0.
+	std::vector<size_t> leavesPerDepth;	//[d] = num of leaves at depth d.
+	std::vector<size_t> nodesPerDepth;	//[d] = num of nodes stored in leaves at depth d.
+	std::vector<size_t> occupancy;		//[i] = num of leaves holding i nodes, i <= bucket capacity. the last entry counts leaves over capacity.
+	size_t overflowLeaves;		//leaves at max depth holding more than bucket capacity nodes.
+	size_t overflowNodes;		//nodes stored in them past bucket capacity.
+	size_t blocks;				//bucket blocks in use.
+	size_t bytesUsed;			//same as bytesUsed().
+};
+
+/* events counted when QUADTREE_INSTRUMENTATION is defined, totals since the tree was created or resetCounters() was called. */
+struct QuadTreeCounters
+{
+	enum Counter { SUBDIVISIONS, COLLAPSES, COLLAPSED_NODES, REARRANGED_NODES, LEAF_SEARCHES, LEAF_STEPS, BUCKET_SCANS, COUNT };
+
+	uint64_t subdivisions;		//quadrants split by subdivide().
+	uint64_t collapses;			//subtrees merged back into their parent by removeSubtree(), commit() and compact().
+	uint64_t collapsedNodes;	//nodes moved up by those merges.
+	uint64_t rearrangedNodes;	//nodes pushed down to new subtrees by reArrangeNodes().
+	uint64_t leafSearches;		//descents from a quadrant to the leaf of a point (find, remove, insert, update...).
+	uint64_t leafSteps;			//levels descended by them, leafSteps / leafSearches is the average length of a search.
+	uint64_t bucketScans;		//slots compared while looking for a point in a bucket.
+};
+
+/* operations reported to the timing hook */
+enum QuadTreeOperation
+{
+	INSERT_OPERATION, REMOVE_OPERATION, UPDATE_OPERATION, FIND_OPERATION, QUERY_OPERATION, QUERY_CIRCLE_OPERATION,
+	NEAREST_OPERATION, COMMIT_OPERATION, BULK_LOAD_OPERATION, PUBLISH_OPERATION, COMPACT_OPERATION,
+	RAYCAST_OPERATION
+};
+
+/* called with the operation and its duration in nanoseconds once it's done.
+* const operations (find, queries, nearest) can run on several threads at once, so can the hook.
+*/
+typedef std::function<void(QuadTreeOperation, uint64_t)> QuadTreeTimingHook;
+
+/* reports the time between its construction and its destruction to @hook, the clock isn't read at all if there's no hook. */
+class QuadTreeOperationTimer
+{
+public:
+	QuadTreeOperationTimer(const QuadTreeOperationTimer&) = delete;				//forbid copy constructor
+	QuadTreeOperationTimer& operator=(QuadTreeOperationTimer const&) = delete;	//forbid copy assignment operator
+
+	QuadTreeOperationTimer(const QuadTreeTimingHook& hook, QuadTreeOperation operation) : m_hook(hook), m_operation(operation)
+	{
+		if (m_hook) {
+			m_start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~QuadTreeOperationTimer()
+	{
+		if (m_hook) {
+			m_hook(m_operation, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count()));
+		}
+	}
+
+private:
+	const QuadTreeTimingHook& m_hook;
+	QuadTreeOperation m_operation;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+#ifdef QUADTREE_INSTRUMENTATION
+#define QUADTREE_COUNT(counter, n) (m_counters[QuadTreeCounters::counter].fetch_add(uint64_t(n), std::memory_order_relaxed))
+#define QUADTREE_TIME(operation) QuadTreeOperationTimer operationTimer_(m_timingHook, operation)
+#else
+#define QUADTREE_COUNT(counter, n) ((void)0)
+#define QUADTREE_TIME(operation) ((void)0)
+#endif
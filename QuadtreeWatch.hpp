@@ -0,0 +1,170 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Standing region watches of QuadTree, see QuadTree::watch().
+*
+* Every watch is a rectangle and a callback, attached to the deepest quadrant that every point of the rectangle descends through.
+* A point can only be inside the watches attached to the quadrants on its path from the root, so insert, remove and update
+* test those and nothing else: the cost follows the nodes that actually cross a boundary, not the num of watches times their results.
+* Each quadrant record keeps a copy of the rectangles attached to it in a flat array, so walking a path is a few linear scans,
+* and the arrays are only allocated once the tree has a watch.
+*/
+
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/* what happened to a node, reported to the callback of every watch it crossed */
+enum QuadWatchEvent
+{
+	WATCH_ENTER,	//node was inserted in the rectangle, or moved into it.
+	WATCH_EXIT		//node was removed from the rectangle, or moved out of it.
+};
+
+template<class Callback>
+class QuadWatchList
+{
+public:
+	/* a watch attached to a quadrant */
+	struct Entry
+	{
+		float x1, y1, x2, y2;	//rectangle, edges included like QuadTree::query().
+		int id;
+
+		/* NaN is in no rectangle. */
+		inline bool contains(float x, float y) const
+		{
+			return x >= x1 && x <= x2 && y >= y1 && y <= y2;
+		}
+	};
+
+	QuadWatchList() : m_free(-1), m_count(0) {}
+
+	/* stores a new watch, detached, and returns its id. ids of removed watches are reused. */
+	int add(float x1, float y1, float x2, float y2, Callback callback)
+	{
+		int id;
+		if (m_free >= 0) {
+			id = m_free;
+			m_free = m_watches[id].pos;
+		}
+		else {
+			id = int(m_watches.size());
+			m_watches.emplace_back();
+		}
+		Watch& watch = m_watches[id];
+		Entry entry = { x1, y1, x2, y2, id };
+		watch.entry = entry;
+		watch.callback = std::move(callback);
+		watch.quad = -1;
+		watch.pos = -1;
+		m_count++;
+		return id;
+	}
+
+	/* detaches and frees @id, false if it isn't a watch. */
+	bool erase(int id)
+	{
+		if (!isValid(id)) {
+			return false;
+		}
+		detach(id);
+		Watch& watch = m_watches[id];
+		watch.callback = Callback();
+		watch.quad = FREE;
+		watch.pos = m_free;
+		m_free = id;
+		m_count--;
+		return true;
+	}
+
+	/* appends @id to the watches of quadrant @q, @id must be detached. */
+	void attach(int id, int q)
+	{
+		Watch& watch = m_watches[id];
+		std::vector<Entry>& entries = m_entries[q];
+		watch.quad = q;
+		watch.pos = int(entries.size());
+		entries.push_back(watch.entry);
+	}
+
+	/* removes @id from the watches of its quadrant, the last one takes its place. */
+	void detach(int id)
+	{
+		Watch& watch = m_watches[id];
+		if (watch.quad < 0) {
+			return;
+		}
+		std::vector<Entry>& entries = m_entries[watch.quad];
+		entries[watch.pos] = entries.back();
+		m_watches[entries[watch.pos].id].pos = watch.pos;
+		entries.pop_back();
+		watch.quad = watch.pos = -1;
+	}
+
+	/* moves every watch of quadrant @from to quadrant @to. */
+	void moveAll(int from, int to)
+	{
+		if (size_t(from) >= m_entries.size()) {
+			return;
+		}
+		while (!m_entries[from].empty()) {
+			int id = m_entries[from].back().id;
+			detach(id);
+			attach(id, to);
+		}
+	}
+
+	/* detaches every watch, they have to be attached again. */
+	void detachAll()
+	{
+		for (std::vector<Entry>& entries : m_entries) {
+			entries.clear();
+		}
+		for (Watch& watch : m_watches) {
+			if (watch.quad != FREE) {
+				watch.quad = watch.pos = -1;
+			}
+		}
+	}
+
+	/* keeps an array for @quads quadrant records (only once there's a watch), new records have no watches. */
+	inline void resizeQuads(size_t quads)
+	{
+		if (m_count > 0 && quads > m_entries.size()) {
+			m_entries.resize(quads);
+		}
+	}
+
+	inline bool isValid(int id) const { return id >= 0 && size_t(id) < m_watches.size() && m_watches[id].quad != FREE; }
+	inline const std::vector<Entry>& at(int q) const { return m_entries[q]; }
+	inline const Entry& rect(int id) const { return m_watches[id].entry; }
+	inline const Callback& callback(int id) const { return m_watches[id].callback; }
+	inline size_t size() const { return m_count; }
+	inline size_t slots() const { return m_watches.size(); }
+
+	size_t bytesUsed() const
+	{
+		size_t bytes = m_watches.capacity() * sizeof(Watch) + m_entries.capacity() * sizeof(std::vector<Entry>);
+		for (const std::vector<Entry>& entries : m_entries) {
+			bytes += entries.capacity() * sizeof(Entry);
+		}
+		return bytes;
+	}
+
+private:
+	static const int FREE = -2;	//quad of a free slot.
+
+	struct Watch
+	{
+		Entry entry;
+		Callback callback;
+		int quad;				//quadrant the watch is attached to, -1 if detached, FREE if the slot is free.
+		int pos;				//index in the array of the quadrant, next free slot if the slot is free.
+	};
+
+	std::vector<Watch> m_watches;				//indexed by id.
+	std::vector<std::vector<Entry>> m_entries;	//watches attached to every quadrant record.
+	int m_free;									//first free slot, -1 if none.
+	size_t m_count;
+};
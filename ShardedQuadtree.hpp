@@ -0,0 +1,276 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* QuadTree split into a fixed grid of shards that can be written from many threads at once.
+*
+* The root is pre-split into shardsX * shardsY cells, every cell is an independent QuadTree guarded by its own mutex,
+* so writers working on different regions never wait on each other. A node belongs to the cell its coordinates fall in,
+* nodes outside of the tree belong to the cells along the edge (same as QuadTree).
+* Operations that touch more than one shard (moves across a shard boundary, queries spanning several cells) lock every shard
+* they need in ascending index order before touching any of them, so they're atomic and can't deadlock with each other.
+* Handles name the shard and the node's handle in that shard, a move to another shard rewrites the caller's handle.
+*/
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include "Quadtree.hpp"
+
+template<class T>
+class ShardedQuadTree
+{
+public:
+	/* id of a node, see insert() and update(Handle&, x, y) */
+	struct Handle
+	{
+		int shard;
+		typename QuadTree<T>::Handle node;
+	};
+
+	ShardedQuadTree(const ShardedQuadTree&) = delete;				//forbid copy constructor
+	ShardedQuadTree& operator=(ShardedQuadTree const&) = delete;	//forbid copy assignment operator
+	ShardedQuadTree() = delete;										//forbid default constructor
+
+	//x1,y1 x2,y2 boundaries of the whole tree, split into @shardsX * @shardsY cells of the same size.
+	//@bucketCapacity and @depth are passed to the QuadTree of every shard.
+	explicit ShardedQuadTree(float x1, float y1, float x2, float y2, int bucketCapacity, int depth = INT32_MAX, int shardsX = 8, int shardsY = 8)
+	{
+		m_x1 = x1;
+		m_y1 = y1;
+		m_shardsX = std::max(1, shardsX);
+		m_shardsY = std::max(1, shardsY);
+		m_cellWidth = (x2 - x1) / m_shardsX;
+		m_cellHeight = (y2 - y1) / m_shardsY;
+		for (int row = 0; row < m_shardsY; ++row) {
+			for (int col = 0; col < m_shardsX; ++col) {
+				float cellX = x1 + col * m_cellWidth;
+				float cellY = y1 + row * m_cellHeight;
+				//last row and column end exactly on x2,y2, rounding can't leave a gap there.
+				float cellX2 = col + 1 == m_shardsX ? x2 : cellX + m_cellWidth;
+				float cellY2 = row + 1 == m_shardsY ? y2 : cellY + m_cellHeight;
+				m_shards.emplace_back(new Shard(cellX, cellY, cellX2, cellY2, bucketCapacity, depth));
+			}
+		}
+	}
+
+	/* inserts a node at x,y holding @data into the shard it belongs to, only that shard is locked.
+	* returns its handle, shard is -1 if a node with the same coordinates is already in the tree.
+	*/
+	Handle insert(float x, float y, const T& data)
+	{
+		int shard = shardIndex(x, y);
+		std::lock_guard<std::mutex> lock(m_shards[shard]->mutex);
+		return makeHandle(shard, m_shards[shard]->tree.insert(x, y, data));
+	}
+
+	/* Moves the node @handle points to, to x,y.
+	* Within a shard it's QuadTree::update(Handle, x, y) under the shard's lock. Across shards both shards are locked,
+	* the node is inserted into the new shard and removed from the old one, other threads see it either before or after the move,
+	* and @handle is rewritten to point to the new shard.
+	* returns false (and leaves @handle as is) if @handle is invalid or another node already sits at x,y.
+	* Moving the same handle from two threads at once isn't supported, the same way it isn't for QuadTree.
+	*/
+	bool update(Handle& handle, float x, float y)
+	{
+		if (handle.shard < 0 || handle.shard >= int(m_shards.size())) {
+			return false;
+		}
+		int target = shardIndex(x, y);
+		if (target == handle.shard) {
+			Shard& shard = *m_shards[target];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			return shard.tree.update(handle.node, x, y);
+		}
+
+		Shard& source = *m_shards[handle.shard];
+		Shard& destination = *m_shards[target];
+		std::unique_lock<std::mutex> first(handle.shard < target ? source.mutex : destination.mutex);
+		std::unique_lock<std::mutex> second(handle.shard < target ? destination.mutex : source.mutex);
+		const QNode<T>* stored = source.tree.getNode(handle.node);
+		if (stored == nullptr) {
+			return false;
+		}
+		QNode<T> moved(*stored);
+		moved.x = x;
+		moved.y = y;
+		typename QuadTree<T>::Handle node = destination.tree.insert(&moved);
+		if (node == QuadTree<T>::INVALID_HANDLE) {
+			return false;
+		}
+		source.tree.remove(handle.node);
+		handle = makeHandle(target, node);
+		return true;
+	}
+
+	/* removes the node @handle points to, only its shard is locked. */
+	void remove(const Handle& handle)
+	{
+		if (handle.shard >= 0 && handle.shard < int(m_shards.size())) {
+			Shard& shard = *m_shards[handle.shard];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.tree.remove(handle.node);
+		}
+	}
+
+	/* removes the node at @node's coordinates if there is one, only its shard is locked. */
+	void remove(const QNode<T>& node)
+	{
+		Shard& shard = *m_shards[shardIndex(node.x, node.y)];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.tree.remove(node);
+	}
+
+	/* copies the node @handle points to into @out, false if @handle is invalid.
+	* The node is copied under the shard's lock, a pointer into the shard could be moved by another writer.
+	*/
+	bool getNode(const Handle& handle, QNode<T>& out) const
+	{
+		if (handle.shard < 0 || handle.shard >= int(m_shards.size())) {
+			return false;
+		}
+		const Shard& shard = *m_shards[handle.shard];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		const QNode<T>* stored = shard.tree.getNode(handle.node);
+		if (stored == nullptr) {
+			return false;
+		}
+		out = *stored;
+		return true;
+	}
+
+	/* true if a node at @node's coordinates is in the tree. */
+	bool find(const QNode<T>& node) const
+	{
+		const Shard& shard = *m_shards[shardIndex(node.x, node.y)];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		return shard.tree.find(node);
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node inside the rectangle x1,y1 - x2,y2 (inclusive).
+	* Every shard the rectangle overlaps is locked for the whole query, so it sees a consistent state of the tree.
+	* @visitor runs under the locks, it must not modify the tree.
+	*/
+	template<class Visitor>
+	void query(float x1, float y1, float x2, float y2, Visitor&& visitor) const
+	{
+		int col1 = column(x1), col2 = column(x2);
+		int row1 = row(y1), row2 = row(y2);
+		lockRange(col1, row1, col2, row2);
+		for (int r = row1; r <= row2; ++r) {
+			for (int c = col1; c <= col2; ++c) {
+				m_shards[r * m_shardsX + c]->tree.query(x1, y1, x2, y2, visitor);
+			}
+		}
+		unlockRange(col1, row1, col2, row2);
+	}
+
+	/* same as above, but appends copies of the nodes found to @out, pointers would be invalidated by other writers. */
+	void query(float x1, float y1, float x2, float y2, vector<QNode<T>>& out) const
+	{
+		query(x1, y1, x2, y2, [&out](const QNode<T>& node) { out.push_back(node); });
+	}
+
+	/* Calls @visitor(const QNode<T>&) for every node within @radius of cx,cy (inclusive), locks the same way query() does. */
+	template<class Visitor>
+	void queryCircle(float cx, float cy, float radius, Visitor&& visitor) const
+	{
+		int col1 = column(cx - radius), col2 = column(cx + radius);
+		int row1 = row(cy - radius), row2 = row(cy + radius);
+		lockRange(col1, row1, col2, row2);
+		for (int r = row1; r <= row2; ++r) {
+			for (int c = col1; c <= col2; ++c) {
+				m_shards[r * m_shardsX + c]->tree.queryCircle(cx, cy, radius, visitor);
+			}
+		}
+		unlockRange(col1, row1, col2, row2);
+	}
+
+	/* same as above, but appends copies of the nodes found to @out. */
+	void queryCircle(float cx, float cy, float radius, vector<QNode<T>>& out) const
+	{
+		queryCircle(cx, cy, radius, [&out](const QNode<T>& node) { out.push_back(node); });
+	}
+
+	/* removes every node, all the shards are locked at once. */
+	void clear()
+	{
+		lockRange(0, 0, m_shardsX - 1, m_shardsY - 1);
+		for (const std::unique_ptr<Shard>& shard : m_shards) {
+			shard->tree.clear();
+		}
+		unlockRange(0, 0, m_shardsX - 1, m_shardsY - 1);
+	}
+
+	/* num of nodes in the tree, all the shards are locked at once so a node being moved is counted once. */
+	int size() const
+	{
+		int count = 0;
+		lockRange(0, 0, m_shardsX - 1, m_shardsY - 1);
+		for (const std::unique_ptr<Shard>& shard : m_shards) {
+			count += shard->tree.size();
+		}
+		unlockRange(0, 0, m_shardsX - 1, m_shardsY - 1);
+		return count;
+	}
+
+	/* Getters */
+	inline int getShardsX() const { return m_shardsX; }
+	inline int getShardsY() const { return m_shardsY; }
+
+	/* index of the shard x,y belongs to, row major. */
+	inline int shardIndex(float x, float y) const { return row(y) * m_shardsX + column(x); }
+
+private:
+
+	struct Shard
+	{
+		Shard(float x1, float y1, float x2, float y2, int bucketCapacity, int depth) : tree(x1, y1, x2, y2, bucketCapacity, depth) {}
+
+		mutable std::mutex mutex;
+		QuadTree<T> tree;
+	};
+
+	static inline Handle makeHandle(int shard, typename QuadTree<T>::Handle node)
+	{
+		Handle handle = { node == QuadTree<T>::INVALID_HANDLE ? -1 : shard, node };
+		return handle;
+	}
+
+	/* cell of x (y), clamped to the grid so nodes outside of the tree go to the edge. monotonic, so a range maps to a range of cells. */
+	inline int column(float x) const
+	{
+		float cell = (x - m_x1) / m_cellWidth;
+		return cell < 0.0f ? 0 : (cell >= float(m_shardsX) ? m_shardsX - 1 : std::min(int(cell), m_shardsX - 1));
+	}
+
+	inline int row(float y) const
+	{
+		float cell = (y - m_y1) / m_cellHeight;
+		return cell < 0.0f ? 0 : (cell >= float(m_shardsY) ? m_shardsY - 1 : std::min(int(cell), m_shardsY - 1));
+	}
+
+	/* locks the shards of every cell in col1,row1 - col2,row2, ascending index order like every other multi-shard lock. */
+	void lockRange(int col1, int row1, int col2, int row2) const
+	{
+		for (int r = row1; r <= row2; ++r) {
+			for (int c = col1; c <= col2; ++c) {
+				m_shards[r * m_shardsX + c]->mutex.lock();
+			}
+		}
+	}
+
+	void unlockRange(int col1, int row1, int col2, int row2) const
+	{
+		for (int r = row1; r <= row2; ++r) {
+			for (int c = col1; c <= col2; ++c) {
+				m_shards[r * m_shardsX + c]->mutex.unlock();
+			}
+		}
+	}
+
+	float m_x1, m_y1;
+	float m_cellWidth, m_cellHeight;
+	int m_shardsX, m_shardsY;
+	vector<std::unique_ptr<Shard>> m_shards;	//row major, each shard is allocated on its own so their locks don't share a cache line.
+};
@@ -0,0 +1,185 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Small work-stealing thread pool used by the parallel traversals of QuadTree.
+*
+* Every worker has its own task deque: tasks submitted from a worker go to the back of its deque and it takes them back from there
+* (newest first, so recursive traversals go depth first and stay in cache), idle workers steal from the front of other deques
+* (oldest first, the largest pieces of work). Tasks submitted from other threads go to a shared deque.
+* Tasks can submit more tasks, wait() makes the calling thread run tasks too until all of them are done.
+* wait() counts the task it's called from as pending, so it must be called from outside the pool's tasks.
+* Tasks must not throw.
+*/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+
+class ThreadPool
+{
+public:
+	ThreadPool(const ThreadPool&) = delete;				//forbid copy constructor
+	ThreadPool& operator=(ThreadPool const&) = delete;	//forbid copy assignment operator
+
+	//@threads num of worker threads, 0 uses every core.
+	explicit ThreadPool(unsigned threads = 0)
+	{
+		if (threads == 0) {
+			threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		m_pending = 0;
+		m_queued = 0;
+		m_stop = false;
+		//one deque per worker plus the shared one for other threads.
+		for (unsigned i = 0; i <= threads; ++i) {
+			m_queues.emplace_back(new TaskQueue());
+		}
+		for (unsigned i = 0; i < threads; ++i) {
+			m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+		}
+	}
+
+	~ThreadPool()
+	{
+		wait();
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& thread : m_threads) {
+			thread.join();
+		}
+	}
+
+	/* num of worker threads */
+	inline unsigned size() const { return unsigned(m_threads.size()); }
+
+	/* index of the calling thread in [0, size()) if it's a worker of this pool, size() otherwise.
+	* Use it to pick a per-thread buffer, threads that aren't workers share the last one.
+	*/
+	inline unsigned threadIndex() const
+	{
+		const ThreadSlot& slot = currentSlot();
+		return slot.pool == this ? slot.index : size();
+	}
+
+	/* queues @task, it runs on one of the workers (or on a thread inside wait()). */
+	void submit(std::function<void()> task)
+	{
+		m_pending++;
+		m_queued++;
+		TaskQueue& queue = *m_queues[threadIndex()];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex); //a worker between its check and its wait would miss the notify otherwise.
+		}
+		m_wake.notify_one();
+	}
+
+	/* runs queued tasks on the calling thread until every task submitted to the pool is done, including the ones submitted by tasks. */
+	void wait()
+	{
+		unsigned self = threadIndex();
+		while (m_pending.load() > 0) {
+			if (!runOne(self)) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+private:
+
+	struct TaskQueue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	struct ThreadSlot
+	{
+		const ThreadPool* pool;
+		unsigned index;
+	};
+
+	static ThreadSlot& currentSlot()
+	{
+		static thread_local ThreadSlot slot = { nullptr, 0 };
+		return slot;
+	}
+
+	/* runs one task, the newest of queue @self or the oldest of another queue. false if every queue is empty. */
+	bool runOne(unsigned self)
+	{
+		std::function<void()> task;
+		if (!popBack(*m_queues[self], task)) {
+			bool stolen = false;
+			for (size_t i = 1; i < m_queues.size() && !stolen; ++i) {
+				stolen = popFront(*m_queues[(self + i) % m_queues.size()], task);
+			}
+			if (!stolen) {
+				return false;
+			}
+		}
+		m_queued--;
+		task();
+		m_pending--;
+		return true;
+	}
+
+	static bool popBack(TaskQueue& queue, std::function<void()>& task)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			return false;
+		}
+		task = std::move(queue.tasks.back());
+		queue.tasks.pop_back();
+		return true;
+	}
+
+	static bool popFront(TaskQueue& queue, std::function<void()>& task)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			return false;
+		}
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		return true;
+	}
+
+	void workerLoop(unsigned index)
+	{
+		ThreadSlot& slot = currentSlot();
+		slot.pool = this;
+		slot.index = index;
+		while (true) {
+			if (runOne(index)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(m_sleepMutex);
+			m_wake.wait(lock, [this] { return m_stop || m_queued.load() > 0; });
+			if (m_stop) {
+				return;
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<TaskQueue>> m_queues;	//one per worker, the last one is shared by every other thread.
+	std::vector<std::thread> m_threads;
+	std::atomic<size_t> m_pending;	//submitted tasks that haven't finished yet.
+	std::atomic<size_t> m_queued;	//tasks sitting in a queue.
+	std::atomic<bool> m_stop;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+};
@@ -1,198 +1,760 @@
+/* Github: @odemiral
+* MIT License Copyright(c) 2015 Onur Demiralay
+* Benchmark driver: times insert, bulk load, find, range, k nearest, update and remove (plus sharded inserts per thread count,
+* and insert, find and range of a PagedQuadTree per cache size) on uniform, clustered and grid point sets,
+* and prints the results as JSON so two runs can be diffed.
+* Before that, range, circle and k nearest queries of every backend are checked against a brute-force scan (points outside of the tree included),
+* the mismatches are reported under "crossCheck" and make the exit code 1.
+*
+* Everything is generated from the seed (default 42) with std::mt19937 and hand-written conversions,
+* the standard distributions aren't specified bit for bit and would give other points with another standard library.
+* Latencies are measured per operation and include the cost of reading the clock (tens of ns).
+*
+* quadtree_bench [--points N] [--queries N] [--seed N] [--capacity N] [--depth N] [--distribution uniform|clustered|grid|all]
+*	[--point-index 0|1] [--paged-caches N,N,...] [--page-size N] [--paged-file file] [--out file]
+* --point-index 1 turns on QuadTree::usePointIndex() for the tree built by insert.
+* --paged-caches lists the cache sizes (in pages, default 64,1024,16384) the paged tree is measured with, 0 skips it.
+* Its pages go to --paged-file (default quadtree_bench.pages, deleted when the tree is), which is likely still in the cache
+* of the OS when it's read back: misses cost a system call and a copy here, a cold disk costs a seek on top.
+* Build with QUADTREE_LINEAR_BACKEND defined to measure LinearQuadtree.hpp instead.
+*/
 
 #include <iostream>
-#include "Quadtree.hpp"
-#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
 #include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <set>
+#include "QuadtreeBackend.hpp"
+#include "ShardedQuadtree.hpp"
+#include "PagedQuadtree.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
 
 using namespace std;
 
-#ifdef _DEBUG 
-	#define _CRTDBG_MAP_ALLOC
-	#include <stdlib.h>
-	#include <crtdbg.h>
-#endif
+typedef std::chrono::steady_clock Clock;
 
+static const float WIDTH = 1920;	//same screen as the old demo, the grid distribution is every pixel of it.
+static const float HEIGHT = 1080;
 
-template <typename T>
-void insertionTest(shared_ptr<QuadTree<T>>& tree)
+struct Options
+{
+	size_t points = 1000000;
+	size_t queries = 200000;
+	uint32_t seed = 42;
+	int capacity = 8;
+	int depth = 20;
+	string distribution = "all";
+	string out;
+	bool pointIndex = false;
+	vector<size_t> pagedCaches = { 64, 1024, 16384 };
+	size_t pageSize = 4096;
+	string pagedFile = "quadtree_bench.pages";
+};
+
+/* one line of the report */
+struct Result
 {
-	cout << "insertion test" << endl;
-	QNode<T> node1(750, 500);
-	QNode<T> node2(150, 200);
-	QNode<T> node3(10, 10);
-	tree->insert(&node1);
-	cout << "inserting node (" << node1.x << ", " << node1.y << ")" << endl;
-	tree->insert(&node2);
-	cout << "inserting node (" << node2.x << ", " << node2.y << ")" << endl;
-	tree->insert(&node3);
-	cout << "inserting node (" << node3.x << ", " << node3.y << ")" << endl;
+	string distribution;
+	string operation;
+	unsigned threads;
+	size_t count;			//num of operations
+	double seconds;			//wall time of all of them
+	vector<float> latencies;	//ns per operation, empty when only the total is measured.
+	uint64_t checksum;		//num of nodes found, inserted, ... so runs can be compared for correctness too.
+	size_t treeBytes;
+	size_t peakRssKb;		//peak resident memory of the process so far.
+	size_t cachePages = 0;	//cache size of the paged tree, 0 for the others.
+	uint64_t pagesRead = 0;	//pages the paged tree read from its file.
+};
+
+/* mt19937 is specified exactly, the conversions below too, so the same seed gives the same points everywhere. */
+class Random
+{
+public:
+	explicit Random(uint32_t seed) : m_rng(seed) {}
 
-	tree->insert(350, 500, 1);
-	cout << "inserting node (350, 500)" << endl;
+	//[0, 1)
+	inline float uniform() { return float(m_rng() >> 8) * (1.0f / 16777216.0f); }
 
-	tree->insert(500, 100, 1);
-	cout << "inserting node (500, 100)" << endl;
+	//[0, n)
+	inline uint32_t below(uint32_t n) { return uint32_t((uint64_t(m_rng()) * n) >> 32); }
 
-	tree->insert(300, 100, 1);
-	cout << "inserting node (300, 100)" << endl;
+	//standard normal, Box-Muller
+	inline float normal()
+	{
+		float u1 = 1.0f - uniform();
+		float u2 = uniform();
+		return std::sqrt(-2.0f * std::log(u1)) * std::cos(6.2831853f * u2);
+	}
 
-	tree->insert(900, 600, 1);
-	cout << "inserting node (900, 600)" << endl;
+private:
+	std::mt19937 m_rng;
+};
 
+size_t peakRssKb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize / 1024;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return size_t(usage.ru_maxrss) / 1024; //bytes on macOS, KB on Linux.
+#else
+	return size_t(usage.ru_maxrss);
+#endif
+#endif
 }
-int myrandom(int i) { return std::rand() % i; }
 
+/* @count points of @distribution inside WIDTH x HEIGHT, data is the index of the point.
+* uniform: anywhere. clustered: 32 gaussian clusters (sigma = 1% of the width) clamped to the screen.
+* grid: integer coordinates, @count distinct pixels of the screen in random order (all of them at most).
+*/
+vector<QNode<int>> generate(const string& distribution, size_t count, Random& random)
+{
+	vector<QNode<int>> nodes;
+	if (distribution == "grid") {
+		size_t width = size_t(WIDTH), height = size_t(HEIGHT);
+		vector<uint32_t> pixels(width * height);
+		for (size_t i = 0; i < pixels.size(); ++i) {
+			pixels[i] = uint32_t(i);
+		}
+		count = std::min(count, pixels.size());
+		for (size_t i = 0; i < count; ++i) {
+			std::swap(pixels[i], pixels[i + random.below(uint32_t(pixels.size() - i))]);
+			nodes.push_back(QNode<int>(float(pixels[i] % width), float(pixels[i] / width), int(i)));
+		}
+		return nodes;
+	}
+	nodes.reserve(count);
+	if (distribution == "clustered") {
+		const int clusters = 32;
+		const float sigma = WIDTH / 100;
+		vector<float> centers;
+		for (int i = 0; i < clusters; ++i) {
+			centers.push_back(random.uniform() * WIDTH);
+			centers.push_back(random.uniform() * HEIGHT);
+		}
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t c = random.below(clusters);
+			float x = centers[2 * c] + random.normal() * sigma;
+			float y = centers[2 * c + 1] + random.normal() * sigma;
+			x = std::min(std::max(x, 0.0f), WIDTH - 0.001f);
+			y = std::min(std::max(y, 0.0f), HEIGHT - 0.001f);
+			nodes.push_back(QNode<int>(x, y, int(i)));
+		}
+		return nodes;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		nodes.push_back(QNode<int>(random.uniform() * WIDTH, random.uniform() * HEIGHT, int(i)));
+	}
+	return nodes;
+}
 
-template <typename T>
-void findTest(shared_ptr<QuadTree<T>>& tree)
+inline float elapsedNs(Clock::time_point start, Clock::time_point end)
 {
-	cout << "find test" << endl;
-	QNode<T> node1(10, 10);
-	QNode<T> node2(900, 600);
-	QNode<T> node3(1234, 123);
-	cout << "trying to find a node that doesn't exist" << endl;
-	cout << "found? " << tree->find(node3) << endl;
-	cout << "trying to find nodes in the tree" << endl;
-	cout << "found? " << tree->find(node2) << endl;
-	cout << "found? " << tree->find(node1) << endl;
+	return float(std::chrono::duration<double, std::nano>(end - start).count());
 }
 
-template <typename T>
-void removalTest(shared_ptr<QuadTree<T>>& tree)
+inline double elapsedSeconds(Clock::time_point start)
 {
-	cout << "removal test" << endl;
-	QNode<T> node1(1000000, 100000);
-	QNode<T> node2(10, 10);
-	cout << "removing a node that doesn't exist" << endl;
-	tree->remove(node1);
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
 
-	cout << "removing a node in the tree" << endl;
-	tree->remove(node2);
+/* times @op(i) for i in [0, count) one by one. */
+template<class Op>
+Result measure(const string& distribution, const string& operation, size_t count, Op op)
+{
+	Result result;
+	result.distribution = distribution;
+	result.operation = operation;
+	result.threads = 1;
+	result.count = count;
+	result.checksum = 0;
+	result.latencies.resize(count);
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < count; ++i) {
+		Clock::time_point before = Clock::now();
+		result.checksum += op(i);
+		result.latencies[i] = elapsedNs(before, Clock::now());
+	}
+	result.seconds = elapsedSeconds(start);
+	return result;
 }
 
-template <typename T>
-void updateTest(shared_ptr<QuadTree<T>>& tree)
+/* runs every operation on @distribution, appends one result per operation to @results. */
+void benchmarkDistribution(const Options& options, const string& distribution, vector<Result>& results)
 {
-	cout << "update test" << endl;
-	QNode<T> node1(300, 100); 
-	QNode<T> node2(350, 500);
-	QNode<T> node3(900, 600);
-	QNode<T> node4(10, 10);
-	QNode<T> node5(999, 999);
-	cout << "updating nodes in the tree" << endl;
-	tree->update(node1, 1000, 800);
-	tree->update(node2, 1050, 700);
-	tree->update(node3, 1300, 600);
-	tree->update(node4, 33, 999);
+	Random random(options.seed);
+	vector<QNode<int>> nodes = generate(distribution, options.points, random);
+	size_t queries = options.queries;
+	cerr << distribution << ": " << nodes.size() << " points" << endl;
+
+	auto finish = [&](Result result, const QuadTreeBackend<int>& tree) {
+		result.treeBytes = tree.bytesUsed();
+		result.peakRssKb = peakRssKb();
+		results.push_back(std::move(result));
+	};
+
+	QuadTreeBackend<int> tree(0, 0, WIDTH, HEIGHT, options.capacity, options.depth);
+#ifndef QUADTREE_LINEAR_BACKEND
+	tree.usePointIndex(options.pointIndex);
+#endif
+	Result inserted = measure(distribution, "insert", nodes.size(), [&](size_t i) {
+		tree.insert(nodes[i].x, nodes[i].y, nodes[i].m_data);
+		//the linear backend only buffers insertions, the first read sorts them in: make it the last insert, not the first find.
+		return (i + 1 == nodes.size()) ? uint64_t(tree.size()) : uint64_t(0);
+	});
+	inserted.checksum = uint64_t(tree.size()); //clustered points can land on the same coordinates, those aren't inserted.
+	finish(std::move(inserted), tree);
+
+	{
+		QuadTreeBackend<int> loaded(0, 0, WIDTH, HEIGHT, options.capacity, options.depth);
+		finish(measure(distribution, "bulk_load", 1, [&](size_t) {
+			loaded.bulkLoad(nodes, 1);
+			return uint64_t(loaded.size());
+		}), loaded);
+	}
+	{
+		QuadTreeBackend<int> loaded(0, 0, WIDTH, HEIGHT, options.capacity, options.depth);
+		Result result = measure(distribution, "bulk_load_parallel", 1, [&](size_t) {
+			loaded.bulkLoad(nodes, 0);
+			return uint64_t(loaded.size());
+		});
+		result.threads = std::max(1u, std::thread::hardware_concurrency());
+		finish(std::move(result), loaded);
+	}
 
-	cout << "updating a node that doesn't exist" << endl;
-	tree->update(node5, 1111, 1111);
+	//half of the finds hit a node of the tree, the other half random points.
+	vector<QNode<int>> probes;
+	for (size_t i = 0; i < queries; ++i) {
+		probes.push_back((i & 1) ? nodes[random.below(uint32_t(nodes.size()))] : QNode<int>(random.uniform() * WIDTH, random.uniform() * HEIGHT));
+	}
+	finish(measure(distribution, "find", queries, [&](size_t i) {
+		return uint64_t(tree.find(probes[i]));
+	}), tree);
+
+	//32x32 windows, about 500 points each for a million uniform points.
+	const float window = 32;
+	finish(measure(distribution, "range", queries, [&](size_t i) {
+		uint64_t found = 0;
+		tree.query(probes[i].x - window / 2, probes[i].y - window / 2, probes[i].x + window / 2, probes[i].y + window / 2, [&found](const QNode<int>&) { ++found; });
+		return found;
+	}), tree);
+
+	vector<const QNode<int>*> neighbors;
+	finish(measure(distribution, "knn", queries, [&](size_t i) {
+		neighbors.clear();
+		tree.nearest(probes[i].x, probes[i].y, 8, neighbors);
+		return uint64_t(neighbors.size());
+	}), tree);
+
+#ifndef QUADTREE_LINEAR_BACKEND
+	//points as generated for the paged tree, update moves nodes and the probes were taken before it.
+	const vector<QNode<int>> generated = nodes;
+#endif
 
-	cout << "updating a node that has been updated before" << endl;
-	tree->update(node4, 333, 999); 
+	//short moves (up to 4 pixels) of random nodes, like entities moving between frames.
+	vector<size_t> moved;
+	vector<float> targets;
+	for (size_t i = 0; i < queries; ++i) {
+		moved.push_back(random.below(uint32_t(nodes.size())));
+		targets.push_back(std::min(std::max(nodes[moved.back()].x + (random.uniform() - 0.5f) * 8, 0.0f), WIDTH - 0.001f));
+		targets.push_back(std::min(std::max(nodes[moved.back()].y + (random.uniform() - 0.5f) * 8, 0.0f), HEIGHT - 0.001f));
+	}
+	finish(measure(distribution, "update", queries, [&](size_t i) {
+		QNode<int>& node = nodes[moved[i]];
+		tree.update(node, targets[2 * i], targets[2 * i + 1]);
+		return uint64_t(node.x == targets[2 * i] && node.y == targets[2 * i + 1]);
+	}), tree);
+
+	vector<size_t> order(nodes.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	size_t removals = std::min(queries, nodes.size());
+	for (size_t i = 0; i < removals; ++i) {
+		std::swap(order[i], order[i + random.below(uint32_t(order.size() - i))]);
+	}
+	int before = tree.size();
+	Result removed = measure(distribution, "remove", removals, [&](size_t i) {
+		tree.remove(nodes[order[i]]);
+		return uint64_t(0);
+	});
+	removed.checksum = uint64_t(before - tree.size());
+	finish(std::move(removed), tree);
+
+	//1, 2, 4, ... writers inserting into a sharded tree, each thread takes its own slice of the points.
+	unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+		ShardedQuadTree<int> sharded(0, 0, WIDTH, HEIGHT, options.capacity, options.depth, 16, 16);
+		Clock::time_point start = Clock::now();
+		vector<std::thread> writers;
+		for (unsigned t = 0; t < threads; ++t) {
+			writers.emplace_back([&sharded, &nodes, t, threads] {
+				for (size_t i = t; i < nodes.size(); i += threads) {
+					sharded.insert(nodes[i].x, nodes[i].y, nodes[i].m_data);
+				}
+			});
+		}
+		for (std::thread& writer : writers) {
+			writer.join();
+		}
+		Result result;
+		result.distribution = distribution;
+		result.operation = "sharded_insert";
+		result.threads = threads;
+		result.count = nodes.size();
+		result.seconds = elapsedSeconds(start);
+		result.checksum = uint64_t(sharded.size());
+		result.treeBytes = 0;
+		result.peakRssKb = peakRssKb();
+		results.push_back(std::move(result));
+	}
+
+#ifndef QUADTREE_LINEAR_BACKEND
+	//the same inserts, finds and ranges through a cache of each size, the leaves of the tree live in the paged file.
+	for (size_t cachePages : options.pagedCaches) {
+		if (cachePages == 0) {
+			continue;
+		}
+		std::unique_ptr<PagedQuadTree<int>> paged = PagedQuadTree<int>::create(options.pagedFile, 0, 0, WIDTH, HEIGHT, cachePages, options.pageSize, options.depth);
+		if (!paged) {
+			cerr << "can't create " << options.pagedFile << endl;
+			return;
+		}
+		auto finishPaged = [&](Result result) {
+			result.treeBytes = paged->bytesUsed();
+			result.peakRssKb = peakRssKb();
+			result.cachePages = cachePages;
+			result.pagesRead = paged->pageStats().pagesRead;
+			paged->resetPageStats();
+			results.push_back(std::move(result));
+		};
+		finishPaged(measure(distribution, "paged_insert", generated.size(), [&](size_t i) {
+			return uint64_t(paged->insert(generated[i].x, generated[i].y, generated[i].m_data));
+		}));
+		finishPaged(measure(distribution, "paged_find", queries, [&](size_t i) {
+			return uint64_t(paged->find(probes[i]));
+		}));
+		finishPaged(measure(distribution, "paged_range", queries, [&](size_t i) {
+			uint64_t found = 0;
+			paged->query(probes[i].x - window / 2, probes[i].y - window / 2, probes[i].x + window / 2, probes[i].y + window / 2, [&found](const QNode<int>&) { ++found; });
+			return found;
+		}));
+	}
+#endif
+}
 
-	cout << "updating a node that has set to outside of the tree" << endl;
-	//tree->update(node3, 1333, 666);
+static const size_t CHECK_NEIGHBORS = 8;	//k of the nearest queries of the cross-check.
 
-	//tree->update(node4, 1, 2);
+/* points and queries the backends are cross-checked with, and the brute-force answers. */
+struct CheckSet
+{
+	vector<QNode<int>> nodes;
+	vector<float> rects;		//x1, y1, x2, y2 of every range.
+	vector<float> circles;		//cx, cy, radius of every circle.
+	vector<float> probes;		//x, y of every nearest query.
+	vector<vector<int>> inRects;		//sorted data of the nodes inside each range.
+	vector<vector<int>> inCircles;
+	vector<vector<float>> nearest;	//distances squared to the CHECK_NEIGHBORS closest nodes, closest first.
+};
+
+/* mismatches of one backend */
+struct CrossCheck
+{
+	string backend;
+	size_t queries;
+	size_t mismatches;
+};
 
+inline float distSq(const QNode<int>& node, float x, float y)
+{
+	float dx = node.x - x;
+	float dy = node.y - y;
+	return dx * dx + dy * dy;
 }
 
+/* 2000 uniform points, 600 piled up past the top left corner (more than a page of the paged tree) and 64 anywhere
+* within a screen of the tree, queries spread over the same area. Nodes at the coordinates of an earlier one are dropped, like insert() does.
+*/
+CheckSet makeCheckSet(uint32_t seed)
+{
+	CheckSet set;
+	Random random(seed);
+	std::set<std::pair<float, float>> taken;
+	auto add = [&](float x, float y) {
+		if (taken.insert(std::make_pair(x, y)).second) {
+			set.nodes.push_back(QNode<int>(x, y, int(set.nodes.size())));
+		}
+	};
+	for (int i = 0; i < 2000; ++i) {
+		add(random.uniform() * WIDTH, random.uniform() * HEIGHT);
+	}
+	for (int i = 0; i < 600; ++i) {
+		add(-1 - random.uniform() * 64, -1 - random.uniform() * 64);
+	}
+	for (int i = 0; i < 64; ++i) {
+		add((random.uniform() * 3 - 1) * WIDTH, (random.uniform() * 3 - 1) * HEIGHT);
+	}
+
+	auto anywhere = [&](float* x, float* y) {
+		*x = (random.uniform() * 2 - 0.5f) * WIDTH;
+		*y = (random.uniform() * 2 - 0.5f) * HEIGHT;
+	};
+	for (int i = 0; i < 200; ++i) {
+		float x, y;
+		anywhere(&x, &y);
+		float w = random.uniform() * 200, h = random.uniform() * 200;
+		float rect[4] = { x - w, y - h, x + w, y + h };
+		set.rects.insert(set.rects.end(), rect, rect + 4);
+		anywhere(&x, &y);
+		float circle[3] = { x, y, random.uniform() * 200 };
+		set.circles.insert(set.circles.end(), circle, circle + 3);
+		anywhere(&x, &y);
+		set.probes.push_back(x);
+		set.probes.push_back(y);
+	}
+	//around single nodes outside of the tree, and everything.
+	for (size_t i = set.nodes.size() - 8; i < set.nodes.size(); ++i) {
+		float rect[4] = { set.nodes[i].x - 1, set.nodes[i].y - 1, set.nodes[i].x + 1, set.nodes[i].y + 1 };
+		set.rects.insert(set.rects.end(), rect, rect + 4);
+		float circle[3] = { set.nodes[i].x, set.nodes[i].y, 1 };
+		set.circles.insert(set.circles.end(), circle, circle + 3);
+		set.probes.push_back(set.nodes[i].x + 1);
+		set.probes.push_back(set.nodes[i].y);
+	}
+	float all[4] = { -4 * WIDTH, -4 * HEIGHT, 4 * WIDTH, 4 * HEIGHT };
+	set.rects.insert(set.rects.end(), all, all + 4);
+
+	for (size_t r = 0; r < set.rects.size(); r += 4) {
+		vector<int> inside;
+		for (const QNode<int>& node : set.nodes) {
+			if (node.x >= set.rects[r] && node.y >= set.rects[r + 1] && node.x <= set.rects[r + 2] && node.y <= set.rects[r + 3]) {
+				inside.push_back(node.m_data);
+			}
+		}
+		set.inRects.push_back(std::move(inside));
+	}
+	for (size_t c = 0; c < set.circles.size(); c += 3) {
+		vector<int> inside;
+		for (const QNode<int>& node : set.nodes) {
+			if (distSq(node, set.circles[c], set.circles[c + 1]) <= set.circles[c + 2] * set.circles[c + 2]) {
+				inside.push_back(node.m_data);
+			}
+		}
+		set.inCircles.push_back(std::move(inside));
+	}
+	for (size_t p = 0; p < set.probes.size(); p += 2) {
+		vector<float> dists;
+		for (const QNode<int>& node : set.nodes) {
+			dists.push_back(distSq(node, set.probes[p], set.probes[p + 1]));
+		}
+		std::sort(dists.begin(), dists.end());
+		dists.resize(std::min(dists.size(), CHECK_NEIGHBORS));
+		set.nearest.push_back(std::move(dists));
+	}
+	return set;
+}
 
-template <typename T>
-void clearTest(shared_ptr<QuadTree<T>>& tree)
+/* counts the ranges and circles of @set @tree doesn't answer like the brute-force scan. */
+template<class Tree>
+void checkRanges(const CheckSet& set, Tree& tree, CrossCheck& check)
 {
-	cout << "removing all the contents of the tree" << endl;
-	tree->clear();
+	vector<int> found;
+	auto visitor = [&found](const QNode<int>& node) { found.push_back(node.m_data); };
+	for (size_t r = 0; r < set.rects.size(); r += 4) {
+		found.clear();
+		tree.query(set.rects[r], set.rects[r + 1], set.rects[r + 2], set.rects[r + 3], visitor);
+		std::sort(found.begin(), found.end());
+		check.queries++;
+		check.mismatches += found != set.inRects[r / 4];
+	}
 }
 
+template<class Tree>
+void checkCircles(const CheckSet& set, Tree& tree, CrossCheck& check)
+{
+	vector<int> found;
+	auto visitor = [&found](const QNode<int>& node) { found.push_back(node.m_data); };
+	for (size_t c = 0; c < set.circles.size(); c += 3) {
+		found.clear();
+		tree.queryCircle(set.circles[c], set.circles[c + 1], set.circles[c + 2], visitor);
+		std::sort(found.begin(), found.end());
+		check.queries++;
+		check.mismatches += found != set.inCircles[c / 3];
+	}
+}
 
-void smallTreeTest()
+/* distances are compared rather than nodes, nodes at the same distance can come in any order. */
+template<class Tree>
+void checkNearest(const CheckSet& set, Tree& tree, CrossCheck& check)
 {
-	shared_ptr<QuadTree<float>> qTree(new QuadTree<float>(0, 0, 1920, 1080, 1, 3));
-	insertionTest(qTree);
-	system("pause");
-	findTest(qTree);
-	system("pause");
-	updateTest(qTree);
-	system("pause");
-	removalTest(qTree);
-	system("pause");
-	clearTest(qTree);
+	vector<const QNode<int>*> found;
+	vector<float> dists;
+	for (size_t p = 0; p < set.probes.size(); p += 2) {
+		found.clear();
+		dists.clear();
+		tree.nearest(set.probes[p], set.probes[p + 1], CHECK_NEIGHBORS, found);
+		for (const QNode<int>* node : found) {
+			dists.push_back(distSq(*node, set.probes[p], set.probes[p + 1]));
+		}
+		check.queries++;
+		check.mismatches += dists != set.nearest[p / 2];
+	}
 }
 
-void largeTreeTest()
+/* Builds every backend from the same points (at unlimited depth, where splits that can't separate nodes would never stop)
+* and checks its queries against the brute-force answers. The paged tree uses --paged-file, the mapped image --paged-file with .img appended.
+*/
+vector<CrossCheck> crossCheck(const Options& options)
 {
-	float width = 1920;
-	float height = 1080;
-	shared_ptr<QuadTree<float>> qTree(new QuadTree<float>(0, 0, width, height, 1, 10));
+#ifdef QUADTREE_LINEAR_BACKEND
+	const string backend = "linear";
+#else
+	const string backend = "pointer";
+#endif
+	CheckSet set = makeCheckSet(options.seed);
+	vector<CrossCheck> checks;
 
-	vector<QNode<float>> vec;
-	//randomly skip too.
-	for (int i = 0; i < width; ++i) {
-		for (int j = 0; j < height; ++j) {
-			vec.push_back(QNode<float>(i, j));
+	QuadTreeBackend<int> inserted(0, 0, WIDTH, HEIGHT, options.capacity);
+	for (const QNode<int>& node : set.nodes) {
+		inserted.insert(node.x, node.y, node.m_data);
+	}
+	CrossCheck insert = { backend, 0, 0 };
+	checkRanges(set, inserted, insert);
+	checkCircles(set, inserted, insert);
+	checkNearest(set, inserted, insert);
+	checks.push_back(insert);
+
+	QuadTreeBackend<int> loaded(0, 0, WIDTH, HEIGHT, options.capacity);
+	loaded.bulkLoad(set.nodes, 1);
+	CrossCheck bulkLoad = { backend + "_bulk_load", 0, 0 };
+	checkRanges(set, loaded, bulkLoad);
+	checkCircles(set, loaded, bulkLoad);
+	checkNearest(set, loaded, bulkLoad);
+	checks.push_back(bulkLoad);
+
+#ifndef QUADTREE_LINEAR_BACKEND
+	std::shared_ptr<const QuadTreeSnapshot<int>> published = inserted.publish();
+	CrossCheck snapshot = { "snapshot", 0, 0 };
+	checkRanges(set, *published, snapshot);
+	checkCircles(set, *published, snapshot);
+	checks.push_back(snapshot);
+
+	//an image that can't be written or mapped counts as one mismatch.
+	string image = options.pagedFile + ".img";
+	CrossCheck mapped = { "mapped", 0, 0 };
+	{
+		std::unique_ptr<const MappedQuadTree<int>> tree = inserted.save(image) ? QuadTree<int>::mapReadOnly(image) : nullptr;
+		if (tree) {
+			checkRanges(set, *tree, mapped);
+			checkCircles(set, *tree, mapped);
+			checkNearest(set, *tree, mapped);
+		}
+		else {
+			mapped.mismatches++;
 		}
 	}
-	cout << "shuffling the vec" << endl;
-	std::random_shuffle(vec.begin(), vec.end(), myrandom);
+	std::remove(image.c_str());
+	checks.push_back(mapped);
 
-	QNode<float> n1 = vec.at(vec.size() - 100);
-	QNode<float> n2 = vec.at(vec.size() - 200);
-	QNode<float> n3 = vec.at(vec.size() - 300);
-	QNode<float> n4 = vec.at(vec.size() - 400);
-	QNode<float> n5 = vec.at(vec.size() - 500);
-	QNode<float> n6(width * 3 - 5, height * 5 - 3);
-	cout << n1.x << ", " << n1.y << endl;
-	cout << n2.x << ", " << n2.y << endl;
-	cout << n3.x << ", " << n3.y << endl;
-	cout << n4.x << ", " << n4.y << endl;
-	cout << n5.x << ", " << n5.y << endl;
-
-	cout << "inserting elements to Quadtree" << endl;
-	system("pause");
-	for (int i = 0; i < vec.size() / 2; ++i) {
-		qTree->insert(&vec.back());
-		vec.pop_back();
+	ShardedQuadTree<int> sharded(0, 0, WIDTH, HEIGHT, options.capacity, INT32_MAX, 4, 4);
+	for (const QNode<int>& node : set.nodes) {
+		sharded.insert(node.x, node.y, node.m_data);
 	}
-	cout << "finding nodes" << endl;
-	system("pause");
-	cout << "found? " << qTree->find(n1) << endl;
-	cout << "found? " << qTree->find(n2) << endl;
-	cout << "found? " << qTree->find(n3) << endl;
-	cout << "found? " << qTree->find(n4) << endl;
-	cout << "found? " << qTree->find(n5) << endl;
-	cout << "found? " << qTree->find(n6) << endl;
-
-	cout << "updating nodes" << endl;
-	qTree->update(n1, 1000,100);
-	qTree->update(n2, height / 2, height / 2);
-	qTree->update(n3, width/2, width/2);
-	qTree->update(n4, 123, 456);
-	qTree->update(n5, 1234, 654);
-	qTree->update(n6, 654321, 12345678);
-
-	cout << "deleting nodes" << endl;
-	system("pause");
-	qTree->remove(n1);
-	qTree->remove(n2);
-	qTree->remove(n3);
-	qTree->remove(n4);
-	qTree->remove(n5);
-	qTree->remove(n6);
+	CrossCheck shards = { "sharded", 0, 0 };
+	checkRanges(set, sharded, shards);
+	checkCircles(set, sharded, shards);
+	checks.push_back(shards);
+
+	//a small cache, so pages are evicted and read back.
+	std::unique_ptr<PagedQuadTree<int>> pagedTree = PagedQuadTree<int>::create(options.pagedFile, 0, 0, WIDTH, HEIGHT, 8, options.pageSize);
+	CrossCheck paged = { "paged", 0, 0 };
+	if (pagedTree) {
+		for (const QNode<int>& node : set.nodes) {
+			pagedTree->insert(node.x, node.y, node.m_data);
+		}
+		checkRanges(set, *pagedTree, paged);
+		paged.mismatches += !pagedTree->good();
+	}
+	else {
+		paged.mismatches++;
+	}
+	checks.push_back(paged);
+#endif
+	return checks;
+}
 
-	cout << "clearing tree" << endl;
-	system("pause");
-	qTree->clear();
+/* value at percentile @p (0-100) of @sorted */
+inline float percentile(const vector<float>& sorted, double p)
+{
+	size_t index = size_t(p / 100.0 * double(sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)];
 }
 
-int main()
+void writeJson(ostream& out, const Options& options, const vector<CrossCheck>& checks, vector<Result>& results)
 {
-	std::srand(unsigned(std::time(0)));
-	largeTreeTest();
-	smallTreeTest();
-#ifdef _DEBUG
-	_CrtDumpMemoryLeaks();
+#ifdef QUADTREE_LINEAR_BACKEND
+	const char* backend = "linear";
+#else
+	const char* backend = "pointer";
 #endif
-	system("pause");
-}
\ No newline at end of file
+	out << std::fixed << std::setprecision(1);
+	out << "{\n";
+	out << "  \"backend\": \"" << backend << "\",\n";
+	out << "  \"config\": {\"points\": " << options.points << ", \"queries\": " << options.queries << ", \"seed\": " << options.seed
+		<< ", \"capacity\": " << options.capacity << ", \"depth\": " << options.depth << ", \"pointIndex\": " << (options.pointIndex ? "true" : "false")
+		<< ", \"pageSize\": " << options.pageSize << ", \"hardwareThreads\": " << std::thread::hardware_concurrency() << "},\n";
+	out << "  \"crossCheck\": [";
+	for (size_t c = 0; c < checks.size(); ++c) {
+		out << (c > 0 ? ", " : "") << "{\"backend\": \"" << checks[c].backend << "\", \"queries\": " << checks[c].queries
+			<< ", \"mismatches\": " << checks[c].mismatches << "}";
+	}
+	out << "],\n";
+	out << "  \"results\": [\n";
+	for (size_t r = 0; r < results.size(); ++r) {
+		Result& result = results[r];
+		out << "    {\"distribution\": \"" << result.distribution << "\", \"operation\": \"" << result.operation << "\", \"threads\": " << result.threads
+			<< ", \"count\": " << result.count << ", \"seconds\": " << std::setprecision(6) << result.seconds << std::setprecision(1)
+			<< ", \"opsPerSecond\": " << (result.seconds > 0 ? result.count / result.seconds : 0.0);
+		if (!result.latencies.empty()) {
+			vector<float>& latencies = result.latencies;
+			std::sort(latencies.begin(), latencies.end());
+			out << ", \"latencyNs\": {\"p50\": " << percentile(latencies, 50) << ", \"p90\": " << percentile(latencies, 90)
+				<< ", \"p99\": " << percentile(latencies, 99) << ", \"p999\": " << percentile(latencies, 99.9) << ", \"max\": " << latencies.back() << "}";
+		}
+		out << ", \"checksum\": " << result.checksum << ", \"treeBytes\": " << result.treeBytes << ", \"peakRssKb\": " << result.peakRssKb;
+		if (result.cachePages > 0) {
+			out << ", \"cachePages\": " << result.cachePages << ", \"pagesRead\": " << result.pagesRead;
+		}
+		out << "}"
+			<< (r + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+int usage()
+{
+	cerr << "usage: quadtree_bench [--points N] [--queries N] [--seed N] [--capacity N] [--depth N]"
+		<< " [--distribution uniform|clustered|grid|all] [--point-index 0|1] [--paged-caches N,N,...] [--page-size N] [--paged-file file]"
+		<< " [--out file]" << endl;
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (i + 1 >= argc) {
+			return usage();
+		}
+		string value = argv[++i];
+		if (arg == "--points") {
+			options.points = size_t(std::strtoull(value.c_str(), nullptr, 10));
+		}
+		else if (arg == "--queries") {
+			options.queries = size_t(std::strtoull(value.c_str(), nullptr, 10));
+		}
+		else if (arg == "--seed") {
+			options.seed = uint32_t(std::strtoul(value.c_str(), nullptr, 10));
+		}
+		else if (arg == "--capacity") {
+			options.capacity = std::atoi(value.c_str());
+		}
+		else if (arg == "--depth") {
+			options.depth = std::atoi(value.c_str());
+		}
+		else if (arg == "--distribution") {
+			options.distribution = value;
+		}
+		else if (arg == "--out") {
+			options.out = value;
+		}
+		else if (arg == "--point-index") {
+			options.pointIndex = std::atoi(value.c_str()) != 0;
+		}
+		else if (arg == "--paged-caches") {
+			options.pagedCaches.clear();
+			std::istringstream list(value);
+			string pages;
+			while (std::getline(list, pages, ',')) {
+				options.pagedCaches.push_back(size_t(std::strtoull(pages.c_str(), nullptr, 10)));
+			}
+		}
+		else if (arg == "--page-size") {
+			options.pageSize = size_t(std::strtoull(value.c_str(), nullptr, 10));
+		}
+		else if (arg == "--paged-file") {
+			options.pagedFile = value;
+		}
+		else {
+			return usage();
+		}
+	}
+	if (options.points == 0 || options.capacity <= 0 || options.depth < 0 || options.pageSize == 0) {
+		return usage();
+	}
+
+	vector<string> distributions;
+	if (options.distribution == "all") {
+		distributions.push_back("uniform");
+		distributions.push_back("clustered");
+		distributions.push_back("grid");
+	}
+	else if (options.distribution == "uniform" || options.distribution == "clustered" || options.distribution == "grid") {
+		distributions.push_back(options.distribution);
+	}
+	else {
+		return usage();
+	}
+
+	vector<CrossCheck> checks = crossCheck(options);
+	int status = 0;
+	for (const CrossCheck& check : checks) {
+		if (check.mismatches > 0) {
+			cerr << check.backend << ": " << check.mismatches << " of " << check.queries << " queries differ from a brute-force scan" << endl;
+			status = 1;
+		}
+	}
+
+	vector<Result> results;
+	for (const string& distribution : distributions) {
+		benchmarkDistribution(options, distribution, results);
+	}
+	if (options.out.empty()) {
+		writeJson(cout, options, checks, results);
+		return status;
+	}
+	std::ofstream file(options.out.c_str());
+	if (!file) {
+		cerr << "can't write " << options.out << endl;
+		return 1;
+	}
+	writeJson(file, options, checks, results);
+	return status;
+}